@@ -0,0 +1,101 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+// * Blocking FIFO queue with a fixed capacity
+// * push() waits while the queue is full and pop() waits while it is empty,
+// * so a fast producer cannot run ahead of the consumer by more than the capacity.
+// * close() wakes up both sides, queued items can still be popped afterwards.
+template <typename T>
+class SJSV_boundedqueue {
+    public:
+        explicit SJSV_boundedqueue(size_t _capacity):
+            capacity(_capacity > 0 ? _capacity : 1),
+            is_closed(false) {}
+
+        // * Append an item, waits while the queue is full
+        // * @return false if the queue is closed, the item is not queued
+        bool push(T &&_item) {
+            std::unique_lock<std::mutex> _lock(mutex);
+            not_full.wait(_lock, [this]() { return is_closed || items.size() < capacity; });
+            if (is_closed)
+                return false;
+            items.push_back(std::move(_item));
+            _lock.unlock();
+            not_empty.notify_one();
+            return true;
+        }
+
+        // * Append an item if there is space
+        // * @return false if the queue is full or closed
+        bool try_push(T &&_item) {
+            std::unique_lock<std::mutex> _lock(mutex);
+            if (is_closed || items.size() >= capacity)
+                return false;
+            items.push_back(std::move(_item));
+            _lock.unlock();
+            not_empty.notify_one();
+            return true;
+        }
+
+        // * Take the oldest item, waits while the queue is empty
+        // * @return false if the queue is closed and empty
+        bool pop(T &_item) {
+            std::unique_lock<std::mutex> _lock(mutex);
+            not_empty.wait(_lock, [this]() { return is_closed || !items.empty(); });
+            if (items.empty())
+                return false;
+            _item = std::move(items.front());
+            items.pop_front();
+            _lock.unlock();
+            not_full.notify_one();
+            return true;
+        }
+
+        // * Take the oldest item if there is one
+        // * @return false if the queue is empty
+        bool try_pop(T &_item) {
+            std::unique_lock<std::mutex> _lock(mutex);
+            if (items.empty())
+                return false;
+            _item = std::move(items.front());
+            items.pop_front();
+            _lock.unlock();
+            not_full.notify_one();
+            return true;
+        }
+
+        // * Stop accepting items and wake up all waiting threads
+        void close() {
+            {
+                std::lock_guard<std::mutex> _lock(mutex);
+                is_closed = true;
+            }
+            not_full.notify_all();
+            not_empty.notify_all();
+        }
+
+        inline bool closed() {
+            std::lock_guard<std::mutex> _lock(mutex);
+            return is_closed;
+        }
+
+        inline size_t size() {
+            std::lock_guard<std::mutex> _lock(mutex);
+            return items.size();
+        }
+
+        inline size_t get_capacity() const {
+            return capacity;
+        }
+
+    private:
+        const size_t            capacity;
+        bool                    is_closed;
+        std::deque<T>           items;
+        std::mutex              mutex;
+        std::condition_variable not_full;
+        std::condition_variable not_empty;
+};
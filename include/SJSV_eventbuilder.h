@@ -19,10 +19,20 @@
 
 #include "SJSV_pcapreader.h"
 
+#include <array>
+#include <deque>
+#include <stdexcept>
+
 #define CHN_PER_VMM 64
+#define VMM_PER_FEC 32                  // 5-bit VMM id
+#define CHN_PER_FEC (VMM_PER_FEC * CHN_PER_VMM)
+#define PARSE_BASE_FEC_ID 1              // SRS FEC ids start at 1, 0 marks an unknown header
+#define PARSE_PAYLOAD_BATCH_BYTE (1 << 20)
+#define PARSE_PAYLOAD_QUEUE_LEN 8
 #define RECONSTRUCTION_LIST_LEN 10
 #define RECONSTRUCTION_CHK_LEN 10000
 #define MINIMUM_EVENT_HIT 5
+#define RECONSTRUCTION_SEGMENT_PER_THREAD 4
 
 class SJSV_eventbuilder
 {
@@ -34,9 +44,109 @@ class SJSV_eventbuilder
             Int_t    event_id = 0;
         };
 
+        // * Running state of the frame stream of one FEC
+        struct fec_parse_state {
+            uint64_t timestamp_start         = 0;
+            uint64_t timestamp_current       = 0;
+            bool     first_timestamp_found   = false;
+            bool     is_synced               = false;   // a timestamp was seen since the last resync
+            uint64_t skipped_daq_frame_count = 0;
+            uint64_t time_frame_count        = 0;
+            std::vector<parsed_frame> frame_vec;    // parsed frames of this FEC, merged by finalize_parse
+
+            // * time-sorted parsing: hits wait in the queue of their VMM, each kept sorted in time,
+            // * until the timestamp stream guarantees no earlier hit can follow
+            std::array<std::deque<parsed_frame>, VMM_PER_FEC> vmm_queues;
+            Double_t released_time_ns   = 0;    // time of the last hit moved to frame_vec
+            uint64_t late_frame_count   = 0;    // hits earlier than an already released one
+        };
+
+        // * Running state of the raw data parsing, carried across packets
+        // * Every FEC has its own timestamp stream, so frames are demultiplexed by their FEC id
+        struct parse_state {
+            std::array<fec_parse_state, LINK_FEC_NUM> fec_states;
+
+            // * Drop the current timestamps after a jump in the stream, DAQ frames are
+            // * skipped until the next timestamp frame of their FEC
+            inline void resync() {
+                for (auto &_fec_state : fec_states)
+                    _fec_state.is_synced = false;
+            }
+        };
+
+        // * Contiguous range of frame pointers, iterated like the former pointer vector
+        struct frame_ptr_span {
+            parsed_frame* const*    first   = nullptr;
+            size_t                  count   = 0;
+
+            frame_ptr_span() = default;
+            frame_ptr_span(parsed_frame* const* _first, size_t _count): first(_first), count(_count) {}
+            // * the span does not own the frames, _frames has to outlive it
+            explicit frame_ptr_span(const std::vector<parsed_frame*> &_frames): first(_frames.data()), count(_frames.size()) {}
+            frame_ptr_span(std::vector<parsed_frame*> &&) = delete;
+
+            inline parsed_frame* const* begin() const { return first; }
+            inline parsed_frame* const* end() const { return first + count; }
+            inline size_t size() const { return count; }
+            inline bool empty() const { return count == 0; }
+            inline parsed_frame* operator[](size_t _index) const { return first[_index]; }
+            inline parsed_frame* at(size_t _index) const {
+                if (_index >= count)
+                    throw std::out_of_range("frame_ptr_span index out of range");
+                return first[_index];
+            }
+        };
+
+        // * View of one event, valid until the events are reconstructed again
         struct parsed_event {
-            std::vector<parsed_frame*> frames_ptr;
-            uint32_t id;
+            frame_ptr_span  frames_ptr;
+            uint32_t        id = 0;
+        };
+
+        // * Events in CSR layout: the hits of event i are frames_ptr[frame_offsets[i], frame_offsets[i + 1])
+        // * All events share two arrays, so storing an event allocates nothing once the arrays have grown.
+        struct parsed_event_store {
+            std::vector<parsed_frame*>  frames_ptr;
+            std::vector<uint64_t>       frame_offsets = {0};
+            std::vector<uint32_t>       ids;
+
+            inline size_t size() const { return ids.size(); }
+            inline bool empty() const { return ids.empty(); }
+
+            inline void clear() {
+                frames_ptr.clear();
+                frame_offsets.assign(1, 0);
+                ids.clear();
+            }
+
+            inline void reserve(size_t _event_num, size_t _frame_num) {
+                frames_ptr.reserve(_frame_num);
+                frame_offsets.reserve(_event_num + 1);
+                ids.reserve(_event_num);
+            }
+
+            inline void push_event(const std::vector<parsed_frame*> &_frames, uint32_t _id) {
+                frames_ptr.insert(frames_ptr.end(), _frames.begin(), _frames.end());
+                frame_offsets.push_back(frames_ptr.size());
+                ids.push_back(_id);
+            }
+
+            // * Append all events of _other, renumbering them from _first_id
+            inline void append(const parsed_event_store &_other, uint32_t _first_id) {
+                auto _frame_base = frames_ptr.size();
+                frames_ptr.insert(frames_ptr.end(), _other.frames_ptr.begin(), _other.frames_ptr.end());
+                for (size_t i = 1; i < _other.frame_offsets.size(); i++)
+                    frame_offsets.push_back(_frame_base + _other.frame_offsets[i]);
+                for (size_t i = 0; i < _other.ids.size(); i++)
+                    ids.push_back(_first_id + uint32_t(i));
+            }
+
+            inline parsed_event at(size_t _index) const {
+                parsed_event _event;
+                _event.frames_ptr = frame_ptr_span(frames_ptr.data() + frame_offsets[_index], frame_offsets[_index + 1] - frame_offsets[_index]);
+                _event.id = ids[_index];
+                return _event;
+            }
         };
 
         struct raw_mapping_info {
@@ -48,12 +158,33 @@ class SJSV_eventbuilder
             std::vector<Char_t>  gain_array;
         };
 
+        // * Mapping of one uni channel, two entries per cache line
+        struct alignas(32) channel_lut_entry {
+            Double_t    x_coord     = 0;
+            Double_t    y_coord     = 0;
+            Double_t    cell_size   = 0;
+            Short_t     module      = -1;
+            Short_t     cell_index  = -1;   // row * cells per row + col within the module
+            Bool_t      is_HG       = false;
+            Bool_t      is_mapped   = false;
+        };
+
         struct channel_mapping_info {
-            std::vector<Short_t> uni_channel_array;
+            std::vector<Int_t> uni_channel_array;
             std::vector<Double_t> x_coords_array;
             std::vector<Double_t> y_coords_array;
             std::vector<Double_t> cell_size_array;
             std::vector<Bool_t> is_HG_array;
+
+            // * dense table indexed by uni channel, built with the arrays above
+            std::vector<channel_lut_entry> channel_lut;
+
+            // * @return nullptr if the channel is not mapped
+            inline const channel_lut_entry* lookup(Int_t _uni_channel) const {
+                if (_uni_channel < 0 || size_t(_uni_channel) >= channel_lut.size() || !channel_lut[_uni_channel].is_mapped)
+                    return nullptr;
+                return &channel_lut[_uni_channel];
+            }
         };
 
         struct mapped_event {
@@ -78,7 +209,7 @@ class SJSV_eventbuilder
         }
 
         inline int get_parsed_event_number() {
-            return vec_parsed_event_ptr->size();
+            return parsed_event_store_ptr->size();
         }
 
         inline parsed_frame* frame_at(uint64_t _index){
@@ -94,10 +225,16 @@ class SJSV_eventbuilder
         std::pair<Double_t, Double_t> get_event_hg_CoM(const parsed_event &_event);
 
         // * Load raw data from rootfile created by SJSV_pcapreader
-        // * @param _filename_str: filename of rootfile
+        // * hit archives (SJSV_hitarchive) are recognised by their magic number and loaded instead
+        // * @param _filename_str: filename of rootfile or hit archive
         // * @return: true if success, false if failed
         bool load_raw_data(const std::string &_filename_str);
 
+        // * Load raw data from the packed frame store of SJSV_pcapreader
+        // * @param _frame_store: decoded frames, copied into the event builder
+        // * @return: true if success, false if failed
+        bool load_raw_data(const SJSV_pcapreader::packed_frame_store &_frame_store);
+
         // * Load mapping from csv file
         // * @param _filename_str: filename of csv file
         // * @return: vector of vector of the file
@@ -117,6 +254,10 @@ class SJSV_eventbuilder
         mapped_event map_event(const parsed_event &_parsed_event, const SJSV_eventbuilder::channel_mapping_info &_mapping_info);
         std::pair<Double_t, Double_t> frame_position(const parsed_frame &_frame, const SJSV_eventbuilder::channel_mapping_info &_mapping_info);
 
+        // * Fill the dense channel table of _mapping_info from the mapping arrays
+        // * the first mapping row of a channel wins, as with a linear search
+        static void build_channel_lut(channel_mapping_info &_mapping_info, const raw_mapping_info &_raw_mapping_info);
+
         bool reconstruct_event(Double_t _threshold_time_ns);
 
         // * Set cycle time of BCID in ns
@@ -124,15 +265,64 @@ class SJSV_eventbuilder
             bcid_cycle = _bcid_cycle;
         }
 
+        // * Set the FEC whose hits get the unified channels 0 .. CHN_PER_FEC - 1 when several FECs are present
+        inline void set_base_fec_id(uint8_t _base_fec_id) {
+            base_fec_id = _base_fec_id;
+        }
+
         // * Set TDC slope time of TDC in ns
         inline void set_tdc_slope(uint8_t _tdc_slope) {
             tdc_slope = _tdc_slope;
         }
 
+        // * Produce the parsed hits in time order
+        // * Hits are buffered per VMM and merged as the timestamps advance, so each hit waits at
+        // * most one coarse time range (offset and BCID) instead of the whole run being sorted.
+        inline void set_time_sorted_parsing(bool _enable) {
+            time_sorted_parsing_enabled = _enable;
+        }
+
         // * Parse raw data to parsed data
         // * @return: true if success, false if failed
         bool parse_raw_data();
 
+        // * Decode and parse a .pcap file in one pass, no raw data is kept
+        // * @param _pcapreader: reader with the filename set
+        // * @return: true if success, false if failed
+        bool parse_pcap_data(SJSV_pcapreader &_pcapreader);
+
+        // * Decode and parse a sample of a .pcap file for a quick look
+        // * see SJSV_pcapreader::for_each_sampled_payload, times stay relative to the first sampled timestamp
+        // * @param _fraction: fraction of the file to read
+        // * @param _block_num: number of blocks spread over the file
+        // * @return: true if success, false if failed
+        bool parse_pcap_sample(SJSV_pcapreader &_pcapreader, double _fraction = PREVIEW_FRACTION, int _block_num = PREVIEW_BLOCK_NUM);
+
+        // * Parse a block of decoded frames, e.g. from SJSV_pcapreader::stream_frame_blocks
+        // * Call finalize_parse after the last block
+        // * @param _state: parsing state, carried to the next block
+        // * @return: number of frames parsed
+        inline size_t parse_frame_block(const std::vector<SJSV_pcapreader::uni_frame> &_block, parse_state &_state) {
+            for (auto &_frame : _block)
+                parse_next_frame(_frame, _state);
+            return _block.size();
+        }
+
+        // * Merge the per-FEC frame streams of a parsing state into the parsed data
+        // * A single FEC keeps the channels 0 .. CHN_PER_FEC - 1. With several FECs, FEC f gets the
+        // * unified channels from (f - base FEC id) * CHN_PER_FEC, whichever other FECs are present;
+        // * FEC 0 (unknown header, raw rootfiles without fec_id) and FECs below the base start at 0.
+        // * The FEC clocks are assumed to be synchronised, times are aligned to the earliest
+        // * first timestamp and the streams are interleaved by time.
+        // * @return: true if any frame was parsed
+        bool finalize_parse(parse_state &_state);
+
+        // * Parse the frames of one DAQ UDP payload
+        // * @param _payload: UDP payload, including the raw header
+        // * @param _state: parsing state, carried to the next payload
+        // * @return: number of frames parsed
+        uint32_t parse_daq_payload(const uint8_t* _payload, uint32_t _payload_len, SJSV_pcapreader &_pcapreader, parse_state &_state);
+
         // * Save parsed data to rootfile
         // * @param _filename_str: filename of rootfile
         // * @return: true if success, false if failed
@@ -193,8 +383,21 @@ class SJSV_eventbuilder
         TH2D* quick_plot_mapped_events_sum2(void);
 
 
+        // * Group hits closer than _threshold_time_ns to a seed hit into events
+        // * Time-sorted frames are clustered with a sliding window in one pass, other frames
+        // * with the seed window rescan; both give the same events on sorted input.
         bool reconstruct_event_list(Double_t _threshold_time_ns);
 
+        // * Set the number of threads of reconstruct_event_list
+        // * Time-sorted frames are cut at quiet gaps and the segments clustered in parallel,
+        // * the events and their ids are the same as with one thread
+        // * @param _thread_num: 0 to use all hardware threads
+        inline void set_reconstruction_thread_num(int _thread_num) {
+            if (_thread_num <= 0)
+                _thread_num = std::max(1u, std::thread::hardware_concurrency());
+            reconstruction_thread_num = _thread_num;
+        }
+
         // * Update pedestal to in-class vector
         // * after calling this function, single channel plot will subtract pedestal automatically
         inline void update_pedestal(const std::vector<uint16_t> &_pede_val) {
@@ -224,28 +427,29 @@ class SJSV_eventbuilder
             pedestal_subtraction_enabled = _enable;
         }
 
+        // * @return view of the event, its frames stay valid until the events are reconstructed again
         inline parsed_event event_at(uint64_t _index) {
-            if (_index >= vec_parsed_event_ptr->size()) {
+            if (_index >= parsed_event_store_ptr->size()) {
                 LOG(ERROR) << "Index out of range";
                 return parsed_event();
             }
-            return vec_parsed_event_ptr->at(_index);
+            return parsed_event_store_ptr->at(_index);
         }
 
         inline void check_uni_channels(std::string _info){
             for (auto _frame: *vec_parsed_frame_ptr) {
-                if (_frame.uni_channel > 20000) {
+                if (_frame.uni_channel >= LINK_FEC_NUM * CHN_PER_FEC) {
                     LOG(ERROR) << _info << " " << _frame.uni_channel << " " << _frame.time_ns << " " << _frame.adc;
                 }
             }
         }
 
         inline void show_first_event_info() {
-            if (vec_parsed_event_ptr->size() == 0) {
+            if (parsed_event_store_ptr->size() == 0) {
                 LOG(ERROR) << "No event found";
                 return;
             }
-            auto _event = vec_parsed_event_ptr->at(0);
+            auto _event = parsed_event_store_ptr->at(0);
             // LOG(INFO) << "Event ID: " << _event.id;
             // LOG(INFO) << "Frame number: " << _event.frames_ptr.size();
             // LOG(INFO) << "Frame number (LG): " << _event.frames_LG_ptr.size();
@@ -260,6 +464,12 @@ class SJSV_eventbuilder
         }
 
     private:
+        inline Int_t get_fec_channel_offset(int _fec_id, size_t _fec_num) const {
+            if (_fec_num <= 1 || _fec_id == 0 || _fec_id < base_fec_id)
+                return 0;
+            return Int_t(_fec_id - base_fec_id) * CHN_PER_FEC;
+        }
+
         inline uint16_t get_uni_channel(const SJSV_pcapreader::uni_frame &_frame) {
             return _frame.vmm_id * 64  + _frame.channel;
         }
@@ -281,6 +491,82 @@ class SJSV_eventbuilder
         // * @param _offset_timestamp: timestamp difference from the first frame
         // * @return: parsed_frame
         parsed_frame parse_frame(const SJSV_pcapreader::uni_frame &_frame, uint64_t _offset_timestamp);
+
+        // * Parse the next frame of a FEC stream, DAQ frames before the first timestamp are skipped
+        inline void parse_next_frame(const SJSV_pcapreader::uni_frame &_frame, fec_parse_state &_state) {
+            if (_frame.flag_daq) {
+                if (!_state.is_synced) {
+                    _state.skipped_daq_frame_count++;
+                    return;
+                }
+                if (time_sorted_parsing_enabled)
+                    push_vmm_queue(parse_frame(_frame, _state.timestamp_current - _state.timestamp_start), _frame.vmm_id % VMM_PER_FEC, _state);
+                else
+                    _state.frame_vec.push_back(parse_frame(_frame, _state.timestamp_current - _state.timestamp_start));
+            } else {
+                _state.time_frame_count++;
+                if (!_state.first_timestamp_found) {
+                    _state.timestamp_start = _frame.timestamp;
+                    _state.first_timestamp_found = true;
+                }
+                _state.timestamp_current = _frame.timestamp;
+                _state.is_synced = true;
+                if (time_sorted_parsing_enabled)
+                    release_vmm_queues(get_earliest_hit_time_ns(_state), _state);
+            }
+        }
+
+        // * Earliest time a hit parsed with the current timestamp can have
+        inline Double_t get_earliest_hit_time_ns(const fec_parse_state &_state) {
+            return double(_state.timestamp_current - _state.timestamp_start) * double(bcid_cycle) + 1.5 * double(bcid_cycle) - double(tdc_slope);
+        }
+
+        // * Insert a hit into its VMM queue, equal times keep their arrival order
+        inline void push_vmm_queue(const parsed_frame &_parsed_frame, int _vmm, fec_parse_state &_state) {
+            auto &_queue = _state.vmm_queues[_vmm];
+            if (_queue.empty() || _queue.back().time_ns <= _parsed_frame.time_ns) {
+                _queue.push_back(_parsed_frame);
+                return;
+            }
+            auto _it = _queue.end();
+            while (_it != _queue.begin() && (_it - 1)->time_ns > _parsed_frame.time_ns)
+                --_it;
+            _queue.insert(_it, _parsed_frame);
+        }
+
+        // * Merge the hits earlier than _release_time_ns from the VMM queues into frame_vec
+        void release_vmm_queues(Double_t _release_time_ns, fec_parse_state &_state);
+
+        inline void parse_next_frame(const SJSV_pcapreader::uni_frame &_frame, parse_state &_state) {
+            parse_next_frame(_frame, _state.fec_states[_frame.fec_id & 0xF]);
+        }
+
+        // * Parse the frames of one payload into the state of its FEC
+        uint32_t parse_daq_payload(const uint8_t* _payload, uint32_t _payload_len, SJSV_pcapreader &_pcapreader, fec_parse_state &_state);
+
+        void log_parse_state(const parse_state &_state);
+
+        // * Seed window reconstruction for frames not sorted in time
+        // * every unused frame opens a window of RECONSTRUCTION_CHK_LEN frames
+        void reconstruct_event_list_rescan(Double_t _threshold_time_ns);
+
+        // * One-pass clustering of the time-sorted frames in [_begin, _end)
+        // * @return number of windows cut at RECONSTRUCTION_CHK_LEN frames
+        int cluster_sorted_frames(size_t _begin, size_t _end, Double_t _threshold_time_ns, parsed_event_store &_event_store, uint32_t &_current_event_id);
+
+        // * Cut the time-sorted frames at gaps of at least the threshold and cluster the segments in parallel
+        // * @return number of windows cut at RECONSTRUCTION_CHK_LEN frames
+        int reconstruct_sorted_segments(Double_t _threshold_time_ns);
+
+        // * Apply the hit number and repeated channel rules and store the event in _event_store
+        // * @return true if the event is saved
+        bool save_candidate_event(std::vector<parsed_frame*> &_candidate_frames, parsed_event_store &_event_store, uint32_t &_current_event_id);
+
+        // * Keep only the hit with the larger ADC of a repeated channel
+        void remove_repeated_channels(std::vector<parsed_frame*> &_candidate_frames);
+
+        // * Append the mapped position and value of one hit, unmapped channels are skipped
+        void append_mapped_frame(mapped_event &_mapped_event, const parsed_frame &_frame, const channel_mapping_info &_mapping_info);
     
     private:
         bool is_raw_data_valid;
@@ -290,10 +576,13 @@ class SJSV_eventbuilder
 
         uint8_t bcid_cycle; // in ns
         uint8_t tdc_slope;  // in ns
-        std::vector<SJSV_pcapreader::uni_frame>* vec_frame_ptr;
+        uint8_t base_fec_id;
+        bool time_sorted_parsing_enabled;
+        int  reconstruction_thread_num;
+        SJSV_pcapreader::packed_frame_store* raw_frame_store_ptr;
         std::vector<parsed_frame>* vec_parsed_frame_ptr;
         std::vector<uint16_t>* vec_pedestal_ptr;
-        std::vector<parsed_event>* vec_parsed_event_ptr;
+        parsed_event_store* parsed_event_store_ptr;
 
         channel_mapping_info* mapping_info_ptr;
 };
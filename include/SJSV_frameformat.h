@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+
+// * Bit field of a frame word
+// * The 6 bytes of a frame are read as one big-endian 48-bit word, bit 0 is the last bit of the frame.
+struct frame_field {
+    uint8_t shift;
+    uint8_t width;
+
+    constexpr uint64_t mask() const {
+        return (uint64_t(1) << width) - 1;
+    }
+
+    constexpr uint64_t extract(uint64_t _word) const {
+        return (_word >> shift) & mask();
+    }
+
+    constexpr bool fits(uint8_t _frame_bit_num) const {
+        return width > 0 && width < 64 && shift + width <= _frame_bit_num;
+    }
+};
+
+// * Frame layout of one SRS/VMM3a firmware revision
+// * Every revision gets its own decode kernel generated from this table at compile time,
+// * see decode_frame_words in SJSV_pcapreader.cxx.
+struct frame_format {
+    const char* name;
+    uint32_t    data_id;        // data id of the raw header without the FEC id byte
+    frame_field flag_daq;       // set for DAQ (hit) frames, clear for timestamp frames
+
+    // * DAQ frame
+    frame_field offset;
+    frame_field vmm_id;
+    frame_field adc;
+    frame_field bcid;
+    bool        bcid_gray;      // BCID is sent in Gray code
+    frame_field daqdata38;
+    frame_field channel;
+    frame_field tdc;
+
+    // * timestamp frame, timestamp = (high << low.width) + low
+    frame_field timestamp_high;
+    frame_field timestamp_low;
+};
+
+// * Default SRS VMM3a firmware, "VM3" data id and Gray coded BCID
+inline constexpr frame_format FRAME_FORMAT_VMM3A_SRS = {
+    "vmm3a_srs", 0x564D33,
+    {15, 1},
+    {43, 5}, {38, 5}, {28, 10}, {16, 12}, true, {14, 1}, {8, 6}, {0, 8},
+    {16, 32}, {0, 10}
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "easylogging++.h"
+#include "SJSV_pcapreader.h"
+
+#include <string>
+#include <vector>
+#include <array>
+#include <fstream>
+#include <functional>
+
+#define HITARCHIVE_SUFFIX           ".sjha"
+#define HITARCHIVE_MAGIC            0x3152414856534A53ULL // "SJSVHAR1"
+#define HITARCHIVE_BLOCK_HIT_NUM    65536
+#define HITARCHIVE_FIELD_NUM        8
+
+// * Compact archive of decoded frames
+// * Only the content of the DAQ and timestamp frames is kept, the packet headers are dropped.
+// * Frames are stored in blocks of up to HITARCHIVE_BLOCK_HIT_NUM hits:
+// *   - timestamp markers as varints, hit position and timestamp delta-encoded within the block
+// *   - hits bit-packed, every field stored as offset from its block minimum with the bit width
+// *     of its block range
+// * A block index at the end of the file gives random access, blocks are decoded on demand
+// * into a packed_frame_store whose iterator yields uni_frame.
+class SJSV_hitarchive {
+    public:
+        typedef SJSV_pcapreader::uni_frame          uni_frame;
+        typedef SJSV_pcapreader::packed_frame_store packed_frame_store;
+        typedef std::function<bool(const packed_frame_store &_block, size_t _block_index)> block_callback;
+
+        struct block_info {
+            uint64_t    offset;             // byte offset of the block in the file
+            uint64_t    byte_num;
+            uint64_t    frame_pos;          // number of frames before the block
+            uint32_t    hit_num;
+            uint32_t    marker_num;
+            uint64_t    first_timestamp;    // first marker in the block, 0 if none
+        };
+
+        SJSV_hitarchive();
+        ~SJSV_hitarchive();
+
+        SJSV_hitarchive(const SJSV_hitarchive&) = delete;
+        SJSV_hitarchive& operator=(const SJSV_hitarchive&) = delete;
+
+        // * Check the magic number of a file
+        static bool is_archive_file(const std::string &_filename);
+
+        // * -- writing --
+        // * Create an archive, an existing file is overwritten
+        // * @return true if success, false if fail
+        bool create(const std::string &_filename);
+
+        void append(const uni_frame &_frame);
+
+        void append(const packed_frame_store &_store);
+
+        // * Flush the last block and write the block index
+        // * @return true if success, false if fail
+        bool finish();
+
+        // * -- reading --
+        // * Open an archive and read its block index, blocks are decoded on demand
+        // * @return true if success, false if fail
+        bool open(const std::string &_filename);
+
+        void close();
+
+        inline size_t get_block_num() const {
+            return block_index_vec.size();
+        }
+
+        inline uint64_t get_frame_num() const {
+            return frame_num;
+        }
+
+        inline const block_info& get_block_info(size_t _block_index) const {
+            return block_index_vec[_block_index];
+        }
+
+        // * Find the last block starting at or before a timestamp
+        // * @return block index, -1 if not found
+        int64_t find_block_by_timestamp(uint64_t _timestamp) const;
+
+        // * Decode one block, the frames are appended to _store
+        // * @return true if success, false if the block is corrupted
+        bool decode_block(size_t _block_index, packed_frame_store &_store) const;
+
+        // * Decode the blocks one by one and pass them to _callback
+        // * stops early if _callback returns false
+        // * @return true if all visited blocks are valid
+        bool for_each_block(const block_callback &_callback) const;
+
+        // * Decode all blocks into _store, blocks are decoded in parallel
+        // * @param _thread_num: 0 to use all hardware threads
+        // * @return true if success, false if fail
+        bool load_frames(packed_frame_store &_store, int _thread_num = 0) const;
+
+    private:
+        #pragma pack(push, 1)
+        struct file_header {
+            uint64_t    magic;
+            uint64_t    block_num;
+            uint64_t    frame_num;
+            uint64_t    index_offset;
+        };
+
+        struct block_header {
+            uint32_t    hit_num;
+            uint32_t    marker_num;
+            uint32_t    marker_byte_num;
+            uint32_t    hit_byte_num;
+            uint16_t    field_min[HITARCHIVE_FIELD_NUM];
+            uint8_t     field_width[HITARCHIVE_FIELD_NUM];
+        };
+        #pragma pack(pop)
+
+        // * fields in the order of packed_frame_store::pack_hit
+        static const std::array<uint8_t, HITARCHIVE_FIELD_NUM>  field_shift;
+        static const std::array<uint8_t, HITARCHIVE_FIELD_NUM>  field_bit_num;
+
+        std::string     filename;
+
+        // * writing
+        std::ofstream               out_file;
+        packed_frame_store          pending_block;
+        std::vector<uint8_t>        block_buf;
+
+        // * reading
+        const uint8_t*  mmap_data   = nullptr;
+        size_t          mmap_len    = 0;
+
+        uint64_t                    frame_num = 0;
+        std::vector<block_info>     block_index_vec;
+
+        // * Encode pending_block and write it to the file
+        bool flush_block();
+
+        void encode_block(const packed_frame_store &_block, std::vector<uint8_t> &_buf) const;
+};
@@ -1,8 +1,24 @@
 #pragma once
 
 #include "easylogging++.h"
+#include "SJSV_boundedqueue.h"
+#include "SJSV_frameformat.h"
+#include "SJSV_prefetchreader.h"
 
 #include "stdlib.h"
+#include <thread>
+#include <functional>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "PcapFileDevice.h"
 #include "SystemUtils.h" 
 #include "Packet.h" 
@@ -15,6 +31,8 @@
 #include "TDataType.h"
 #include "TFile.h"
 #include "TTree.h" 
+#include "TROOT.h"
+#include "Compression.h"
 
 #define DAQ_DATA_SRC_PORT   6006
 #define ESS_SC_SRC_PORT     65535
@@ -29,6 +47,42 @@
 #define LEN_RAW_FRAME_BYTE  6
 #define LEN_RAW_HEADER_BYTE 16
 
+#define FRAME_BATCH_SIZE    64
+#define FRAME_FORMAT_PROBE_BYTE (1 << 16)  // capture prefix searched for the first DAQ packet
+
+#define LEN_PCAP_GLOBAL_HEADER_BYTE 24
+#define LEN_PCAP_RECORD_HEADER_BYTE 16
+#define LEN_ETH_HEADER_BYTE         14
+#define LEN_IPV4_MIN_HEADER_BYTE    20
+#define LEN_UDP_HEADER_BYTE         8
+
+#define PACKET_INDEX_SUFFIX         ".sjidx"
+#define PACKET_INDEX_MAGIC          0x3158444956534A53ULL // "SJSVIDX1"
+#define PACKET_INDEX_FLAG_DAQ       0x01
+#define PACKET_INDEX_FLAG_FALLBACK  0x02
+
+#define DECODE_RESERVE_MAX_FRAME_NUM (1 << 22) // reserve cap without a packet index, the vector grows past it
+
+#define PCAP_RESYNC_CHAIN_LEN       8
+#define PCAP_RESYNC_WINDOW_BYTE     (1 << 20)
+#define PCAP_RESYNC_MAX_TIME_SPAN_S (30 * 24 * 3600)
+
+#define STREAM_CHUNK_SIZE_BYTE      (4 << 20)
+#define STREAM_QUEUE_LEN            8
+#define PCAP_STREAM_MAX_CAPLEN_BYTE (256 * 1024)
+
+#define STREAM_BLOCK_FRAME_NUM      (1 << 16)
+#define STREAM_MEMORY_CAP_BYTE      (256 << 20)
+
+#define PREVIEW_FRACTION            0.01
+#define PREVIEW_BLOCK_NUM           16
+
+#define DAQ_HEADER_DATA_ID          0x564D33    // "VM3" in the upper 24 bits of the data id
+#define LINK_FEC_NUM                16
+
+#define ROOT_CLUSTER_ENTRY_NUM      (1 << 20)
+#define ROOT_MIN_BASKET_SIZE_BYTE   (32 * 1024)
+
 // INITIALIZE_EASYLOGGINGPP
 
 class SJSV_pcapreader {
@@ -42,8 +96,303 @@ class SJSV_pcapreader {
             bool        daqdata38;  // 1 bit
             uint8_t     channel;    // 6 bits
             uint8_t     tdc;        // 8 bits
+            uint8_t     fec_id = 0; // 4 bits, from the raw header of the packet
             uint64_t    timestamp;  // 40 bits
         };
+
+        struct packet_index_entry {
+            uint64_t    offset_flags;   // 56 bits record offset, 8 bits flags
+            uint64_t    timestamp_ns;   // capture time
+
+            inline uint64_t offset() const {
+                return offset_flags & 0x00FFFFFFFFFFFFFFULL;
+            }
+            inline uint8_t flags() const {
+                return offset_flags >> 56;
+            }
+        };
+
+        typedef std::function<void(const uint8_t* _payload, uint32_t _payload_len)> payload_callback;
+
+        typedef std::function<void(uint64_t _capture_time_ns, const uint8_t* _payload, uint32_t _payload_len)> timed_payload_callback;
+
+        typedef std::function<void(const uni_frame &_frame)> frame_sink;
+
+        // * @return false to stop the stream
+        typedef std::function<bool(const std::vector<uni_frame> &_block)> frame_block_callback;
+
+        // * Called before the first payload of every sampled block
+        typedef std::function<void(int _block_index)> sample_block_callback;
+
+        enum input_compression {
+            INPUT_UNCOMPRESSED,
+            INPUT_GZIP,
+            INPUT_ZSTD
+        };
+
+        struct pcap_statistics {
+            int64_t     packet_num      = 0;
+            int64_t     eth_packet_num  = 0;
+            int64_t     ip_packet_num   = 0;
+            int64_t     udp_packet_num  = 0;
+            int64_t     daq_packet_num  = 0;
+        };
+
+        // * Link telemetry from the 16-byte DAQ packet header
+        // * The header starts with the frame counter (bytes 0-3) and the data id (bytes 4-7, "VM3"
+        // * in the upper 24 bits and the FEC id in bits 4-7), both big-endian. A counter jump
+        // * counts the skipped packets as lost, a counter going backwards counts as out of order
+        // * and takes back one of the losses.
+        struct link_statistics {
+            struct fec_statistics {
+                uint64_t    packet_num          = 0;
+                uint64_t    frame_num           = 0;
+                uint64_t    byte_num            = 0;
+                uint64_t    lost_packet_num     = 0;
+                uint64_t    out_of_order_num    = 0;
+                uint32_t    first_counter       = 0;
+                uint32_t    last_counter        = 0;
+                bool        is_counter_valid    = false;
+            };
+
+            uint64_t    packet_num          = 0;
+            uint64_t    frame_num           = 0;
+            uint64_t    byte_num            = 0;
+            uint64_t    lost_packet_num     = 0;
+            uint64_t    out_of_order_num    = 0;
+            uint64_t    bad_header_num      = 0;    // too short or not a "VM3" data id
+            uint64_t    first_time_ns       = 0;
+            uint64_t    last_time_ns        = 0;
+            std::array<fec_statistics, LINK_FEC_NUM> fec_stats;
+
+            inline void add_packet(const uint8_t* _payload, uint32_t _payload_len, uint64_t _time_ns) {
+                if (packet_num == 0 || _time_ns < first_time_ns)
+                    first_time_ns = _time_ns;
+                last_time_ns = std::max(last_time_ns, _time_ns);
+                packet_num++;
+                byte_num += _payload_len;
+                if (_payload_len < LEN_RAW_HEADER_BYTE) {
+                    bad_header_num++;
+                    return;
+                }
+                uint32_t _frame_num = (_payload_len - LEN_RAW_HEADER_BYTE) / LEN_RAW_FRAME_BYTE;
+                frame_num += _frame_num;
+                uint32_t _data_id = read_be_u32(_payload + 4);
+                if ((_data_id >> 8) != DAQ_HEADER_DATA_ID) {
+                    bad_header_num++;
+                    return;
+                }
+                auto &_fec = fec_stats[(_data_id >> 4) & 0xF];
+                _fec.packet_num++;
+                _fec.frame_num += _frame_num;
+                _fec.byte_num  += _payload_len;
+                advance_counter(_fec, read_be_u32(_payload));
+            }
+
+            // * Append the statistics of the packets that follow these ones in capture order
+            void merge(const link_statistics &_next);
+
+            inline double get_duration_s() const {
+                return (last_time_ns - first_time_ns) * 1e-9;
+            }
+
+            inline void advance_counter(fec_statistics &_fec, uint32_t _counter) {
+                if (!_fec.is_counter_valid) {
+                    _fec.first_counter    = _counter;
+                    _fec.last_counter     = _counter;
+                    _fec.is_counter_valid = true;
+                    return;
+                }
+                uint32_t _step = _counter - _fec.last_counter;
+                if (_step == 1) {
+                    _fec.last_counter = _counter;
+                } else if (_step == 0 || _step >= 0x80000000u) {
+                    _fec.out_of_order_num++;
+                    out_of_order_num++;
+                    if (_step != 0 && _fec.lost_packet_num > 0) {
+                        _fec.lost_packet_num--;
+                        lost_packet_num--;
+                    }
+                } else {
+                    _fec.lost_packet_num += _step - 1;
+                    lost_packet_num      += _step - 1;
+                    _fec.last_counter = _counter;
+                }
+            }
+
+            static inline uint32_t read_be_u32(const uint8_t* _data) {
+                return (uint32_t(_data[0]) << 24) | (uint32_t(_data[1]) << 16) | (uint32_t(_data[2]) << 8) | _data[3];
+            }
+        };
+
+        // * Compact frame storage
+        // * DAQ hits are packed into one 64-bit word each (bits 0-50, bits 51-63 are spare),
+        // * timestamp frames are kept in a separate stream together with the number of
+        // * hits stored before them, so the original frame order can be restored
+        struct packed_frame_store {
+            struct timestamp_marker {
+                uint64_t    hit_pos;    // number of hits before this marker
+                uint64_t    timestamp;  // bits 0-55, FEC id in bits 56-59
+            };
+
+            std::vector<uint64_t>           hit_word_vec;
+            std::vector<timestamp_marker>   marker_vec;
+
+            // * tdc 0-7, channel 8-13, daqdata38 14, bcid 15-26, adc 27-36, vmm_id 37-41, offset 42-46, fec_id 47-50
+            static inline uint64_t pack_hit(const uni_frame &_frame) {
+                return  uint64_t(_frame.tdc) |
+                       (uint64_t(_frame.channel   & 0x3F)  << 8)  |
+                       (uint64_t(_frame.daqdata38 & 0x1)   << 14) |
+                       (uint64_t(_frame.bcid      & 0xFFF) << 15) |
+                       (uint64_t(_frame.adc       & 0x3FF) << 27) |
+                       (uint64_t(_frame.vmm_id    & 0x1F)  << 37) |
+                       (uint64_t(_frame.offset    & 0x1F)  << 42) |
+                       (uint64_t(_frame.fec_id    & 0xF)   << 47);
+            }
+
+            static inline uint8_t hit_fec_id(uint64_t _word) {
+                return (_word >> 47) & 0xF;
+            }
+
+            static inline uint8_t marker_fec_id(const timestamp_marker &_marker) {
+                return (_marker.timestamp >> 56) & 0xF;
+            }
+
+            static inline uni_frame unpack_hit(uint64_t _word) {
+                uni_frame _frame;
+                _frame.flag_daq  = true;
+                _frame.tdc       =  _word        & 0xFF;
+                _frame.channel   = (_word >> 8)  & 0x3F;
+                _frame.daqdata38 = (_word >> 14) & 0x1;
+                _frame.bcid      = (_word >> 15) & 0xFFF;
+                _frame.adc       = (_word >> 27) & 0x3FF;
+                _frame.vmm_id    = (_word >> 37) & 0x1F;
+                _frame.offset    = (_word >> 42) & 0x1F;
+                _frame.fec_id    = hit_fec_id(_word);
+                _frame.timestamp = 0;
+                return _frame;
+            }
+
+            static inline uni_frame unpack_marker(const timestamp_marker &_marker) {
+                uni_frame _frame = uni_frame();
+                _frame.flag_daq  = false;
+                _frame.fec_id    = marker_fec_id(_marker);
+                _frame.timestamp = _marker.timestamp & 0x00FFFFFFFFFFFFFFULL;
+                return _frame;
+            }
+
+            inline void push_back(const uni_frame &_frame) {
+                if (_frame.flag_daq)
+                    hit_word_vec.push_back(pack_hit(_frame));
+                else
+                    marker_vec.push_back({uint64_t(hit_word_vec.size()), _frame.timestamp | (uint64_t(_frame.fec_id & 0xF) << 56)});
+            }
+
+            inline void append(const uni_frame* _frames, size_t _frame_num) {
+                for (size_t i = 0; i < _frame_num; i++)
+                    push_back(_frames[i]);
+            }
+
+            inline void append(const packed_frame_store &_store) {
+                uint64_t _hit_base = hit_word_vec.size();
+                hit_word_vec.insert(hit_word_vec.end(), _store.hit_word_vec.begin(), _store.hit_word_vec.end());
+                marker_vec.reserve(marker_vec.size() + _store.marker_vec.size());
+                for (auto &_marker : _store.marker_vec)
+                    marker_vec.push_back({_hit_base + _marker.hit_pos, _marker.timestamp});
+            }
+
+            inline void reserve(size_t _frame_num) {
+                hit_word_vec.reserve(_frame_num);
+            }
+
+            // * Distribute the frames to one store per FEC in one pass, the order within a FEC is kept
+            inline void split_by_fec(std::array<packed_frame_store, LINK_FEC_NUM> &_fec_stores) const {
+                size_t _hit_pos = 0;
+                for (auto &_marker : marker_vec) {
+                    for (; _hit_pos < _marker.hit_pos; _hit_pos++)
+                        _fec_stores[hit_fec_id(hit_word_vec[_hit_pos])].hit_word_vec.push_back(hit_word_vec[_hit_pos]);
+                    auto &_fec_store = _fec_stores[marker_fec_id(_marker)];
+                    _fec_store.marker_vec.push_back({uint64_t(_fec_store.hit_word_vec.size()), _marker.timestamp});
+                }
+                for (; _hit_pos < hit_word_vec.size(); _hit_pos++)
+                    _fec_stores[hit_fec_id(hit_word_vec[_hit_pos])].hit_word_vec.push_back(hit_word_vec[_hit_pos]);
+            }
+
+            inline void clear() {
+                hit_word_vec.clear();
+                marker_vec.clear();
+            }
+
+            inline void release() {
+                std::vector<uint64_t>().swap(hit_word_vec);
+                std::vector<timestamp_marker>().swap(marker_vec);
+            }
+
+            inline size_t size() const {
+                return hit_word_vec.size() + marker_vec.size();
+            }
+
+            inline bool empty() const {
+                return hit_word_vec.empty() && marker_vec.empty();
+            }
+
+            inline size_t memory_usage() const {
+                return hit_word_vec.capacity() * sizeof(uint64_t) + marker_vec.capacity() * sizeof(timestamp_marker);
+            }
+
+            // * Forward iterator over the frames in their original order
+            class const_iterator {
+                public:
+                    const_iterator(const packed_frame_store* _store, size_t _hit_pos, size_t _marker_pos):
+                        store(_store), hit_pos(_hit_pos), marker_pos(_marker_pos) {}
+
+                    inline bool is_marker() const {
+                        return marker_pos < store->marker_vec.size() && store->marker_vec[marker_pos].hit_pos == hit_pos;
+                    }
+
+                    // * FEC id of the current frame without unpacking it
+                    inline uint8_t fec_id() const {
+                        if (is_marker())
+                            return marker_fec_id(store->marker_vec[marker_pos]);
+                        return hit_fec_id(store->hit_word_vec[hit_pos]);
+                    }
+
+                    inline uni_frame operator*() const {
+                        if (is_marker())
+                            return unpack_marker(store->marker_vec[marker_pos]);
+                        return unpack_hit(store->hit_word_vec[hit_pos]);
+                    }
+
+                    inline const_iterator& operator++() {
+                        if (is_marker())
+                            marker_pos++;
+                        else
+                            hit_pos++;
+                        return *this;
+                    }
+
+                    inline bool operator==(const const_iterator &_other) const {
+                        return hit_pos == _other.hit_pos && marker_pos == _other.marker_pos;
+                    }
+
+                    inline bool operator!=(const const_iterator &_other) const {
+                        return !(*this == _other);
+                    }
+
+                private:
+                    const packed_frame_store* store;
+                    size_t hit_pos;
+                    size_t marker_pos;
+            };
+
+            inline const_iterator begin() const {
+                return const_iterator(this, 0, 0);
+            }
+
+            inline const_iterator end() const {
+                return const_iterator(this, hit_word_vec.size(), marker_vec.size());
+            }
+        };
     public:
         SJSV_pcapreader();
         SJSV_pcapreader(std::string _filename_str);
@@ -58,18 +407,59 @@ class SJSV_pcapreader {
             if (this->is_reader_valid && reader != nullptr) {
                 reader->close();
                 delete reader;
+                reader = nullptr;
                 this->is_reader_valid = false;
             }
             if (this->is_uniframe_vec_valid){
                 this->uni_frame_vec->clear();
+                this->packed_frames.clear();
                 this->is_uniframe_vec_valid = false;
             }
+            unmap_pcapfile();
+            packet_index_vec.clear();
+            is_packet_index_valid = false;
+            run_file_vec.clear();
             filename = _filename_str; 
         }
 
+        // * Use several capture files as one run
+        // * A directory set as filename is expanded to the capture files it contains.
+        // * The files are decoded concurrently and stitched in order of their first
+        // * capture time, so the last timestamp marker of a file carries over to the next.
+        void set_run_files(const std::vector<std::string> &_filename_vec);
+
+        // * Capture files of the run, ordered by their first capture time
+        // * @return empty if the filename is a single file
+        std::vector<std::string> get_run_files();
+
         // * Read .pcap file
+        // * @param _prescan: count the packets before decoding, this reads the file one extra time
         // * @return true if success, false if fail
-        bool read_pcapfile();
+        bool read_pcapfile(bool _prescan = true);
+
+        // * Open .pcap file once and decode it in the same pass
+        // * packet statistics are gathered while decoding
+        // * @return -1 if fail, otherwise the length of the vector
+        int64_t single_pass_decode_pcapfile();
+
+        inline const pcap_statistics& get_pcap_statistics() const {
+            return pcap_stats;
+        }
+
+        // * Link telemetry of the last decoding or visit
+        inline const link_statistics& get_link_statistics() const {
+            return link_stats;
+        }
+
+        // * Log the link counters every _interval_s of capture time while packets are visited
+        // * serially (for_each_daq_packet, frame streaming); the parallel decoding only logs the total
+        // * @param _interval_s: 0 to disable
+        inline void set_link_stats_dump_interval(double _interval_s) {
+            link_stats_dump_interval_ns = _interval_s > 0 ? uint64_t(_interval_s * 1e9) : 0;
+        }
+
+        void log_link_statistics() const;
+        static void log_link_statistics(const link_statistics &_stats);
 
         // * Test decoding the first packet
         // * @return -1 if fail, otherwise the index of the first daq packet
@@ -78,25 +468,352 @@ class SJSV_pcapreader {
         // * Decode .pcap packet
         // * @return uni_frame
         std::vector<uni_frame> decode_pcap_packet(const pcpp::Packet &_parsedPacket);
+
+        // * Decode .pcap packet into a caller-owned vector
+        // * @param _frame_vec: decoded frames are appended to this vector
+        // * @return number of frames appended
+        uint32_t decode_pcap_packet(const pcpp::Packet &_parsedPacket, std::vector<uni_frame> &_frame_vec);
         inline std::vector<uni_frame> decode_pcap_packet(pcpp::RawPacket _rawPacket){
             pcpp::Packet parsedPacket(&_rawPacket);
             return decode_pcap_packet(parsedPacket);
         }
 
+        // * Decode the UDP payload of a DAQ packet
+        // * @param _payload: pointer to the UDP payload, including the raw header
+        // * @param _payload_len: length of the UDP payload in bytes
+        // * @param _frame_vec: decoded frames are appended to this vector
+        // * @return number of frames appended
+        uint32_t decode_pcap_packet(const uint8_t* _payload, uint32_t _payload_len, std::vector<uni_frame> &_frame_vec);
+
+        // * Decode the UDP payload of a DAQ packet into a caller-owned buffer
+        // * @param _frame_buf: decoded frames are written from the start of this buffer
+        // * @param _frame_capacity: number of frames the buffer can hold, extra frames are dropped
+        // * @return number of frames written
+        uint32_t decode_pcap_packet(const uint8_t* _payload, uint32_t _payload_len, uni_frame* _frame_buf, uint32_t _frame_capacity);
+
+        // * Decode the frames of one UDP payload in batches
+        // * @param _frame_data: pointer to the first frame, i.e. after the raw header
+        // * @param _data_len: length of the frame data in bytes
+        // * @param _frame_vec: decoded frames are appended to this vector
+        // * @param _fec_id: FEC id of the payload, see get_payload_fec_id
+        // * @return number of frames appended
+        uint32_t decode_frame_batch(const uint8_t* _frame_data, uint32_t _data_len, std::vector<uni_frame> &_frame_vec, uint8_t _fec_id = 0);
+        // * _out must hold _data_len / LEN_RAW_FRAME_BYTE frames
+        uint32_t decode_frame_batch(const uint8_t* _frame_data, uint32_t _data_len, uni_frame* _out, uint8_t _fec_id = 0);
+
+        // * FEC id from the data id of the raw header, 0 if the header is not a VMM3 one
+        static inline uint8_t get_payload_fec_id(const uint8_t* _payload, uint32_t _payload_len) {
+            if (_payload_len < LEN_RAW_HEADER_BYTE)
+                return 0;
+            uint32_t _data_id = link_statistics::read_be_u32(_payload + 4);
+            if ((_data_id >> 8) != DAQ_HEADER_DATA_ID)
+                return 0;
+            return (_data_id >> 4) & 0xF;
+        }
+
+        // * Enable or disable the SIMD frame kernels
+        // * the scalar kernel gives bit-identical output
+        inline void set_simd_enabled(bool _enable) {
+            simd_enabled = _enable;
+        }
+
+        // * Name of the frame kernel selected for this CPU
+        static std::string frame_kernel_name();
+
+        // * Select the firmware frame format by name, see get_frame_format_names
+        // * @return false if the name is unknown, the format is not changed then
+        bool set_frame_format(const std::string &_format_name);
+
+        // * Check the data id of the first DAQ packet against the known frame formats
+        // * The raw header carries no firmware revision, so formats are only told apart by their
+        // * data id; formats sharing a data id have to be selected with set_frame_format.
+        // * @return false if no DAQ packet or no format with this data id is found
+        bool probe_frame_format();
+
+        inline const frame_format& get_frame_format() const {
+            return *frame_format_ptr;
+        }
+
+        static std::vector<std::string> get_frame_format_names();
+
+        // * Decode .pcap file through a read-only memory mapping
+        // * Ethernet/IPv4/UDP headers are resolved directly, other packets and
+        // * non-classic captures (e.g. pcapng) fall back to PcapPlusPlus
+        // * gzip and zstd compressed files are detected by their magic number and
+        // * decompressed on a separate thread while decoding, see stream_decode_pcapfile
+        // * With more than one thread, the file is split into packet-aligned ranges
+        // * decoded in parallel; the result is identical to the serial decoding
+        // * @return -1 if fail, otherwise the length of the vector
+        int64_t mmap_decode_pcapfile();
+
+        // * Visit the UDP payload of every DAQ packet in file order without decoding frames
+        // * payloads point into the mapping or the reader buffer and are only valid during the call
+        // * @param _stop: if set, the file is no longer read once it turns true
+        // * @return -1 if fail, otherwise the number of DAQ packets visited
+        int64_t for_each_daq_payload(const payload_callback &_callback, const std::atomic<bool>* _stop = nullptr);
+
+        // * Same as for_each_daq_payload, with the capture time of each packet in ns since the epoch
+        int64_t for_each_daq_packet(const timed_payload_callback &_callback, const std::atomic<bool>* _stop = nullptr);
+
+        // * Visit the DAQ payloads of a sample of the capture for a quick look
+        // * _block_num blocks spread evenly over the file are read, together about _fraction of it.
+        // * The blocks are located through the packet index if it is loaded, otherwise by
+        // * resynchronising on the record headers at the block offsets, the rest of the file is not read.
+        // * Only uncompressed single-file captures can be sampled.
+        // * @param _block_callback: called before each block, the stream is not continuous across blocks
+        // * @return -1 if fail, otherwise the number of DAQ packets visited
+        int64_t for_each_sampled_payload(double _fraction, int _block_num, const payload_callback &_callback, const sample_block_callback &_block_callback = nullptr);
+
+        // * Decode a gzip or zstd compressed .pcap file without writing it to disk
+        // * a decompression thread feeds the decoder through a bounded chunk queue
+        // * uncompressed files are streamed the same way from SJSV_prefetchreader
+        // * @return -1 if fail, otherwise the length of the vector
+        int64_t stream_decode_pcapfile(input_compression _compression);
+
+        // * Compression of the current file, detected from its first bytes
+        input_compression detect_input_compression() const;
+
+        // * Decode the file into fixed-size frame blocks handed to _consumer in file order
+        // * Decoding runs on its own thread ahead of the consumer, the blocks in flight are
+        // * limited by the stream memory cap, so the memory use does not grow with the run length.
+        // * Blocks are reused after the consumer returns, frames must be copied to be kept.
+        // * @return -1 if fail, otherwise the number of frames streamed
+        int64_t stream_frame_blocks(const frame_block_callback &_consumer);
+
+        // * Set the number of frames per block of stream_frame_blocks
+        inline void set_stream_block_frame_num(size_t _frame_num) {
+            stream_block_frame_num = std::max<size_t>(_frame_num, FRAME_BATCH_SIZE);
+        }
+
+        // * Set the memory limit for the frame blocks of stream_frame_blocks
+        // * at least three blocks are used regardless of the limit
+        inline void set_stream_memory_cap(size_t _cap_byte) {
+            stream_memory_cap = _cap_byte;
+        }
+
+        // * Set the number of decoding threads for mmap_decode_pcapfile
+        // * @param _thread_num: 0 to use all hardware threads
+        inline void set_thread_num(int _thread_num) {
+            if (_thread_num <= 0)
+                _thread_num = std::max(1u, std::thread::hardware_concurrency());
+            thread_num = _thread_num;
+        }
+
+        // * Read uncompressed files through SJSV_prefetchreader instead of the memory mapping
+        // * _read_num large reads are kept in flight while the previous chunk is decoded,
+        // * which helps on storage with high latency (network file systems, cold HDDs)
+        // * @param _read_num: 0 to use the memory mapping, decoding is then serial
+        inline void set_prefetch_read_num(int _read_num) {
+            prefetch_read_num = std::max(_read_num, 0);
+        }
+
         // * Decode .pcap file
         // * @return -1 if fail, otherwise the length of the vector
         int64_t full_decode_pcapfile();
 
+        // * Keep decoded frames in the packed store instead of the uni_frame vector
+        // * the packed store needs 8 bytes per DAQ hit instead of sizeof(uni_frame)
+        inline void set_packed_storage(bool _enable) {
+            packed_storage_enabled = _enable;
+        }
+
+        inline bool is_packed_storage() const {
+            return packed_storage_enabled;
+        }
+
+        inline const packed_frame_store& get_packed_frame_store() const {
+            return packed_frames;
+        }
+
+        // * Load the packet index of the current file
+        // * The index is cached next to the pcap file as <filename>.sjidx, a cached
+        // * index is only used if the size and modification time of the pcap match
+        // * @param _build_if_missing: scan the file and write the index if no valid cache exists
+        // * @return true if success, false if fail
+        bool load_packet_index(bool _build_if_missing = true);
+
+        inline int64_t get_indexed_packet_num() const {
+            return is_packet_index_valid ? packet_index_vec.size() : -1;
+        }
+
+        inline const packet_index_entry* packet_index_at(int64_t _packet_index) const {
+            if (!is_packet_index_valid || _packet_index < 0 || _packet_index >= int64_t(packet_index_vec.size()))
+                return nullptr;
+            return &packet_index_vec[_packet_index];
+        }
+
+        // * Find the first packet captured at or after a wall-clock time
+        // * @param _time_ns: capture time in ns since epoch
+        // * @return packet index, -1 if not found
+        int64_t find_packet_by_time(uint64_t _time_ns) const;
+
+        // * Decode a range of indexed packets, frames are appended to the vector
+        // * @param _first_packet: index of the first packet
+        // * @param _packet_num: number of packets to decode
+        // * @return -1 if fail, otherwise the number of frames decoded
+        int64_t decode_indexed_packets(int64_t _first_packet, int64_t _packet_num);
+
         // * Save decoded data to root file
         // * @return true if success, false if fail
         bool save_to_rootfile(const std::string &_rootfilename);
 
+        // * Decode the file and write it to root file block by block
+        // * frames are not kept in memory, see stream_frame_blocks
+        // * @return true if success, false if fail
+        bool stream_to_rootfile(const std::string &_rootfilename);
+
+        // * Save decoded data to a compact hit archive, see SJSV_hitarchive
+        // * @return true if success, false if fail
+        bool save_to_archive(const std::string &_archivename);
+
+        // * Decode the file and write it to a hit archive block by block
+        // * @return true if success, false if fail
+        bool stream_to_archive(const std::string &_archivename);
+
+        // * Set the compression of the root file
+        // * @param _algorithm: e.g. ROOT::kLZ4 for scratch files, ROOT::kZSTD for archived files
+        // * @param _level: compression level, 0 to store uncompressed
+        inline void set_root_compression(ROOT::ECompressionAlgorithm _algorithm, int _level) {
+            root_compression = ROOT::CompressionSettings(_algorithm, _level);
+        }
+
+        // * Set the number of threads ROOT uses to compress baskets
+        // * @param _thread_num: 0 to use all hardware threads, 1 to compress serially
+        inline void set_root_thread_num(int _thread_num) {
+            root_thread_num = _thread_num;
+        }
+
         std::string test_single_frame_decode(const std::vector<uint8_t> &_test_frame);
 
+    private:
+        struct range_decode_result {
+            pcap_statistics stats;
+            int64_t     frame_num           = 0;
+            int64_t     daq_frame_num       = 0;
+            int64_t     time_frame_num      = 0;
+            int64_t     fallback_packet_num = 0;
+            size_t      end_pos             = 0;
+            bool        truncated           = false;
+            uint64_t    capture_time_ns     = 0;    // of the record being processed
+            link_statistics link_stats;
+        };
+
     private:
         // * Convert protocol type to string
         std::string protocol2str(pcpp::ProtocolType _protocol);
 
+        // * Open the reader device for the current filename
+        bool open_reader();
+
+        // * Count the layers found in one packet
+        // * @return the UDP layer, nullptr if not found
+        pcpp::UdpLayer* count_packet_layers(const pcpp::Packet &_parsedPacket, pcap_statistics &_stats);
+
+        void log_pcap_statistics();
+
+        // * Upper bound of the frame number in a part of the capture
+        // * @param _packet_num: number of packets if known, 0 otherwise
+        static uint64_t estimate_frame_num(uint64_t _byte_num, int64_t _packet_num);
+
+        // * Frames to reserve for the records in [_begin, _end) of the mapped file,
+        // * counted from the DAQ packets of the packet index if loaded, capped otherwise
+        uint64_t reserve_frame_num(size_t _begin, size_t _end) const;
+
+        // * Map the current file, only classic pcap files are accepted
+        // * @return true if success, false if the file cannot be mapped
+        bool map_pcapfile();
+        void unmap_pcapfile();
+
+        // * Capture time of a record in ns since epoch
+        inline uint64_t record_time_ns(const uint8_t* _record) const {
+            return uint64_t(read_pcap_u32(_record)) * 1000000000ULL +
+                uint64_t(read_pcap_u32(_record + 4)) * (mmap_nanosec ? 1 : 1000);
+        }
+
+        // * Read the first bytes of the current file, decompressed if needed
+        // * @return number of bytes read
+        size_t read_file_prefix(uint8_t* _buf, size_t _len) const;
+
+        // * Capture time of the first record, UINT64_MAX if it cannot be read without PcapPlusPlus
+        uint64_t peek_first_capture_time_ns();
+
+        // * List the capture files if the filename is a directory
+        // * @return true if the reader works on several files
+        bool expand_run_input();
+
+        // * Decode the run files concurrently and stitch the frames in capture-time order
+        // * @return -1 if fail, otherwise the number of frames
+        int64_t decode_run_files();
+
+        // * Visit the DAQ payloads of all run files in capture-time order
+        int64_t for_each_run_payload(const timed_payload_callback &_callback, const std::atomic<bool>* _stop = nullptr);
+
+        // * Log the link counters of the capture-time window since the last dump
+        void dump_link_window(const link_statistics &_stats, link_statistics &_window_start, uint64_t &_next_dump_ns) const;
+
+        // * Pass the decoding options on to the reader of a single run file
+        void copy_settings_to(SJSV_pcapreader &_reader) const;
+
+        // * Read byte order, time resolution, snaplen and link type of a classic pcap file
+        // * @return false if the magic number is not a classic pcap one
+        bool parse_pcap_global_header(const uint8_t* _header);
+
+        inline uint32_t read_pcap_u32(const uint8_t* _ptr) const {
+            uint32_t _val;
+            memcpy(&_val, _ptr, sizeof(_val));
+            return mmap_swapped ? __builtin_bswap32(_val) : _val;
+        }
+
+        // * Resolve the UDP payload of an Ethernet/IPv4/UDP packet without PcapPlusPlus
+        // * @return true if resolved, false if the packet needs the full layer parser
+        bool locate_udp_payload(const uint8_t* _packet, uint32_t _caplen, const uint8_t* &_payload, uint32_t &_payload_len, uint16_t &_src_port);
+
+        // * Visit the DAQ payloads of the records in [_begin, _end) of the mapping
+        // * stops before the next record once _stop turns true
+        // * @return position after the last record read
+        size_t scan_pcap_range(size_t _begin, size_t _end, range_decode_result &_result, const payload_callback &_callback, const std::atomic<bool>* _stop = nullptr);
+
+        // * Resolve one record and pass its payload to _callback if it is a DAQ packet
+        // * @param _record: record header followed by _caplen bytes of packet data
+        void process_pcap_record(const uint8_t* _record, uint32_t _caplen, range_decode_result &_result, const payload_callback &_callback);
+
+        // * Visit the DAQ payloads of a classic pcap file read in chunks on a separate thread
+        // * compressed files are decompressed, uncompressed ones read by SJSV_prefetchreader
+        // * reading and decompression stop once _stop turns true
+        // * @return false if the (decompressed) data is not a classic pcap file
+        bool scan_chunked_pcapfile(input_compression _compression, range_decode_result &_result, const payload_callback &_callback, const std::atomic<bool>* _stop = nullptr);
+
+        // * Decode one DAQ payload into _frame_vec, or into _packed_store if set
+        void decode_daq_payload(const uint8_t* _payload, uint32_t _payload_len, std::vector<uni_frame> &_frame_vec, range_decode_result &_result, packed_frame_store* _packed_store);
+
+        // * Create the raw tree and fill it with the frames passed by _frame_source to its sink
+        // * @param _entry_num_hint: expected entry number, used to size the baskets
+        bool write_rootfile(const std::string &_rootfilename, int64_t _entry_num_hint, const std::function<bool(const frame_sink&)> &_frame_source);
+
+        // * Sum the statistics of decoded ranges and log them
+        // * @return -1 if no frame was decoded, otherwise the number of frames
+        int64_t summarize_decode_results(const std::vector<range_decode_result> &_results);
+
+        // * Decode the records in [_begin, _end) of the mapping
+        // * @return position after the last record read
+        // * @param _packed_store: if set, frames are moved from _frame_vec into the store after each packet
+        size_t decode_pcap_range(size_t _begin, size_t _end, std::vector<uni_frame> &_frame_vec, range_decode_result &_result, packed_frame_store* _packed_store = nullptr);
+
+        // * Check if a record header starts at _pos of the mapping
+        bool is_pcap_record(size_t _pos);
+
+        // * Split the mapping into packet-aligned ranges
+        // * uses the packet index if loaded, otherwise record headers are searched
+        // * @return range boundaries, from the first record to the end of the file
+        std::vector<size_t> find_range_offsets(int _range_num);
+
+        std::string packet_index_filename() const {
+            return filename + PACKET_INDEX_SUFFIX;
+        }
+        bool read_packet_index_file(uint64_t _file_size, int64_t _file_mtime);
+        bool write_packet_index_file(uint64_t _file_size, int64_t _file_mtime);
+        bool build_packet_index();
+
         // * Convert gray code to binary
         uint32_t Gray2bin32(uint32_t _num);
 
@@ -110,6 +827,9 @@ class SJSV_pcapreader {
         }
 
     private:
+        // * Turns a batch of frame words into uni_frames, one kernel per frame format
+        typedef void (*frame_decode_kernel)(const uint64_t* _words, uint64_t _daq_mask, uint32_t _frame_num, uni_frame* _out, uint8_t _fec_id);
+
         bool is_reader_valid;
         bool is_uniframe_vec_valid;
 
@@ -117,4 +837,38 @@ class SJSV_pcapreader {
         pcpp::IFileReaderDevice* reader;
 
         std::vector<uni_frame>* uni_frame_vec;
+
+        bool                packed_storage_enabled = false;
+        packed_frame_store  packed_frames;
+
+        pcap_statistics pcap_stats;
+        link_statistics link_stats;
+        uint64_t        link_stats_dump_interval_ns = 0;
+
+        bool simd_enabled = true;
+        int  thread_num   = 1;
+        int  prefetch_read_num = 0;
+
+        const frame_format* frame_format_ptr = &FRAME_FORMAT_VMM3A_SRS;
+        frame_decode_kernel frame_decoder    = nullptr;
+
+        size_t stream_block_frame_num = STREAM_BLOCK_FRAME_NUM;
+        size_t stream_memory_cap      = STREAM_MEMORY_CAP_BYTE;
+
+        int  root_compression = -1;    // -1 keeps the ROOT default
+        int  root_thread_num  = 1;
+
+        const uint8_t*  mmap_data      = nullptr;
+        size_t          mmap_len       = 0;
+        bool            mmap_swapped   = false;
+        bool            mmap_nanosec   = false;
+        uint32_t        mmap_linktype  = 0;
+        uint32_t        mmap_snaplen   = 0;
+        uint32_t        mmap_first_ts  = 0;
+
+        bool                            is_packet_index_valid = false;
+        std::vector<packet_index_entry> packet_index_vec;
+
+        std::vector<std::string>        run_file_vec;
+        bool                            is_run_file_vec_ordered = false;
 };
\ No newline at end of file
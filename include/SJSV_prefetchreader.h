@@ -0,0 +1,71 @@
+#pragma once
+
+#include "easylogging++.h"
+#include "SJSV_boundedqueue.h"
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define PREFETCH_READ_NUM           4
+#define PREFETCH_CHUNK_SIZE_BYTE    (4 << 20)
+
+// * Sequential file reader that keeps several large reads in flight
+// * The file is read in fixed-size chunks which are handed over in file order through a
+// * bounded queue, so the consumer decodes one chunk while the next ones are still being
+// * read. With SJSV_WITH_LIBURING the reads are submitted to an io_uring, otherwise every
+// * read slot has its own pread thread.
+class SJSV_prefetchreader {
+    public:
+        typedef SJSV_boundedqueue<std::vector<uint8_t>> chunk_queue;
+
+        SJSV_prefetchreader(const std::string &_filename, int _read_num = PREFETCH_READ_NUM, size_t _chunk_byte = PREFETCH_CHUNK_SIZE_BYTE);
+        ~SJSV_prefetchreader();
+
+        SJSV_prefetchreader(const SJSV_prefetchreader&) = delete;
+        SJSV_prefetchreader& operator=(const SJSV_prefetchreader&) = delete;
+
+        // * Read the whole file and push its chunks to _chunk_queue in file order
+        // * Buffers are recycled from _free_queue when available. Reading stops early
+        // * when _chunk_queue is closed by the consumer.
+        // * @return false if the file cannot be opened or a read fails
+        bool read_file(chunk_queue &_chunk_queue, chunk_queue &_free_queue);
+
+        inline uint64_t get_byte_num() const {
+            return byte_num;
+        }
+
+        // * Name of the backend used for the reads
+        static std::string backend_name();
+
+    private:
+        std::string filename;
+        int         read_num;
+        size_t      chunk_byte;
+        int         file_fd;
+        uint64_t    file_size;
+        uint64_t    byte_num;
+
+        bool open_file();
+        void close_file();
+
+        inline uint64_t get_chunk_num() const {
+            return (file_size + chunk_byte - 1) / chunk_byte;
+        }
+
+        inline size_t get_chunk_len(uint64_t _chunk) const {
+            return size_t(std::min<uint64_t>(chunk_byte, file_size - _chunk * chunk_byte));
+        }
+
+        std::vector<uint8_t> take_buffer(chunk_queue &_free_queue, size_t _len);
+
+        // * one pread thread per read slot
+        bool read_file_threads(chunk_queue &_chunk_queue, chunk_queue &_free_queue);
+#ifdef SJSV_WITH_LIBURING
+        // * all reads submitted to one io_uring from the calling thread
+        bool read_file_uring(chunk_queue &_chunk_queue, chunk_queue &_free_queue);
+#endif
+};
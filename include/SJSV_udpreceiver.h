@@ -0,0 +1,135 @@
+#pragma once
+
+#include "easylogging++.h"
+#include "SJSV_pcapreader.h"
+
+#include <vector>
+#include <string>
+#include <atomic>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define UDP_RECV_BATCH_SIZE         64
+#define UDP_MAX_DATAGRAM_BYTE       9216    // jumbo frame payload
+#define UDP_SOCKET_BUFFER_BYTE      (64 << 20)
+#define UDP_POLL_TIMEOUT_MS         100
+
+// * Live receiver for the DAQ data stream of the SRS FEC
+// * Datagrams are received in batches into a preallocated packet pool and handed to the
+// * same payload callback used by SJSV_pcapreader::for_each_daq_payload, so the decoder
+// * reads them in place. A payload pointer is only valid during the callback, its slot is
+// * reused by the next batch.
+class SJSV_udpreceiver {
+    public:
+        struct receive_statistics {
+            uint64_t datagram_num   = 0;
+            uint64_t byte_num       = 0;
+            uint64_t batch_num      = 0;
+            uint64_t truncated_num  = 0;    // datagrams larger than the pool slot, skipped
+            uint64_t kernel_drop_num = 0;   // datagrams dropped by a full socket buffer, if reported
+        };
+
+        SJSV_udpreceiver(uint16_t _port = DAQ_DATA_SRC_PORT, const std::string &_bind_address = "0.0.0.0");
+        ~SJSV_udpreceiver();
+
+        SJSV_udpreceiver(const SJSV_udpreceiver&) = delete;
+        SJSV_udpreceiver& operator=(const SJSV_udpreceiver&) = delete;
+
+        // * Create the socket, bind it to the data port and allocate the packet pool
+        // * @return false if the socket cannot be created or bound
+        bool open_socket();
+
+        void close_socket();
+
+        inline bool is_open() const {
+            return socket_fd >= 0;
+        }
+
+        // * Number of datagrams taken from the socket per system call, set before open_socket()
+        inline void set_batch_size(uint32_t _batch_size) {
+            if (is_open()) {
+                LOG(WARNING) << "Socket is already open, batch size is not changed";
+                return;
+            }
+            batch_size = std::max<uint32_t>(_batch_size, 1);
+        }
+
+        // * Size of one packet pool slot, set before open_socket()
+        inline void set_max_datagram_size(uint32_t _size_byte) {
+            if (is_open()) {
+                LOG(WARNING) << "Socket is already open, datagram size is not changed";
+                return;
+            }
+            max_datagram_byte = std::max<uint32_t>(_size_byte, LEN_RAW_HEADER_BYTE + LEN_RAW_FRAME_BYTE);
+        }
+
+        // * Requested kernel receive buffer, absorbs bursts while the callback is busy
+        inline void set_socket_buffer_size(int _size_byte) {
+            socket_buffer_byte = _size_byte;
+        }
+
+        inline uint16_t get_port() const {
+            return port;
+        }
+
+        // * Wait up to _timeout_ms for data and pass every received datagram to the callback
+        // * @return -1 if fail, otherwise the number of datagrams received, 0 on timeout
+        int receive_batch(const SJSV_pcapreader::payload_callback &_callback, int _timeout_ms = UDP_POLL_TIMEOUT_MS);
+
+        // * Receive until _stop is set or _duration_ms has passed
+        // * @param _duration_ms: negative to run until stopped
+        // * @return -1 if fail, otherwise the number of datagrams received
+        int64_t run(const SJSV_pcapreader::payload_callback &_callback, const std::atomic<bool> &_stop, int64_t _duration_ms = -1);
+
+        inline const receive_statistics& get_statistics() const {
+            return recv_stats;
+        }
+
+        inline void reset_statistics() {
+            recv_stats = receive_statistics();
+        }
+
+        void log_statistics() const;
+
+    private:
+        uint16_t    port;
+        std::string bind_address;
+        int         socket_fd;
+
+        uint32_t    batch_size;
+        uint32_t    max_datagram_byte;
+        int         socket_buffer_byte;
+
+        // * packet pool, one slot of max_datagram_byte per datagram of a batch
+        std::vector<uint8_t>    pool_buffer;
+        std::vector<iovec>      pool_iovec_vec;
+#ifdef __linux__
+        std::vector<mmsghdr>    pool_msg_vec;
+        std::vector<uint8_t>    pool_control_buffer;
+        uint32_t                last_drop_counter;
+#endif
+
+        receive_statistics recv_stats;
+
+        inline uint8_t* slot_at(uint32_t _index) {
+            return pool_buffer.data() + size_t(_index) * max_datagram_byte;
+        }
+
+        void allocate_packet_pool();
+
+        // * Count one received datagram and pass it on
+        inline void deliver_datagram(const SJSV_pcapreader::payload_callback &_callback, const uint8_t* _data, size_t _len, bool _truncated) {
+            if (_truncated) {
+                recv_stats.truncated_num++;
+                return;
+            }
+            recv_stats.datagram_num++;
+            recv_stats.byte_num += _len;
+            _callback(_data, uint32_t(_len));
+        }
+};
@@ -1,9 +1,11 @@
 #include <iostream>
+#include <sstream>
 #include <unistd.h>
 #include "TCanvas.h" 
 #include "easylogging++.h"
 #include "SJSV_pcapreader.h"
 #include "SJSV_eventbuilder.h"
+#include "SJSV_hitarchive.h"
 
 void set_easylogger(); // set easylogging++ configurations
 
@@ -31,8 +33,21 @@ int main(int argc, char** argv) {
     std::string filename_parsed_root = "../tmp/parsed_" + filename_id + ".root";
     std::string filename_mapping_csv = "../data/config/Mapping_tb2023Sep_VMM3.csv";
 
+    int decode_thread_num = 1;
+    bool use_packet_index = false;
+    bool save_raw_root = false;
+    std::string raw_root_compression = "";
+    double link_stats_interval_s = 0;
+    std::string frame_format_name = "";   // empty - probed from the first DAQ packet
+    double preview_fraction = 0;            // > 0 - only a sample of the capture is decoded
+    int preview_block_num = PREVIEW_BLOCK_NUM;
+    int prefetch_read_num = 0;              // > 0 - read through the prefetching reader instead of mmap
+    std::string filename_archive = "";      // non-empty - also save the decoded frames as hit archive
+    bool time_sorted_parsing = false;       // parse the hits in time order for the one-pass clustering
+    int base_fec_id = PARSE_BASE_FEC_ID;    // FEC whose hits get the unified channels from 0
+
     int opt;
-    while ((opt = getopt(argc, argv, "i:m:d:r:p:a:")) != -1){
+    while ((opt = getopt(argc, argv, "i:m:d:r:p:a:t:xc:l:f:s:b:q:w:oF:")) != -1){
         switch (opt){
             case 'i':
                 script_info = std::string(optarg);
@@ -45,6 +60,7 @@ int main(int argc, char** argv) {
                 break;
             case 'r':
                 filename_raw_root = std::string(optarg);
+                save_raw_root = true;
                 break;
             case 'p':
                 filename_parsed_root = std::string(optarg);
@@ -52,18 +68,81 @@ int main(int argc, char** argv) {
             case 'a':
                 filename_analysis_root = std::string(optarg);
                 break;
+            case 't':
+                decode_thread_num = std::stoi(optarg);
+                break;
+            case 'x':
+                use_packet_index = true;
+                break;
+            case 'c':
+                raw_root_compression = std::string(optarg);
+                break;
+            case 'l':
+                link_stats_interval_s = std::stod(optarg);
+                break;
+            case 'f':
+                frame_format_name = std::string(optarg);
+                break;
+            case 's':
+                preview_fraction = std::stod(optarg);
+                break;
+            case 'b':
+                preview_block_num = std::stoi(optarg);
+                break;
+            case 'q':
+                prefetch_read_num = std::stoi(optarg);
+                break;
+            case 'w':
+                filename_archive = std::string(optarg);
+                break;
+            case 'o':
+                time_sorted_parsing = true;
+                break;
+            case 'F':
+                base_fec_id = std::stoi(optarg);
+                break;
             default:
                 LOG(ERROR) << "Wrong arguments!";
                 return 1;
         }
     }
 
+    // * a hit archive written by -w is loaded directly instead of decoding a capture
+    bool load_archive = SJSV_hitarchive::is_archive_file(filename_pcap);
+    bool save_archive = !filename_archive.empty();
+
     LOG(INFO) << "script_info: " << script_info;
     LOG(INFO) << "filename_mapping_csv: " << filename_mapping_csv;
     LOG(INFO) << "filename_pcap: " << filename_pcap;
-    LOG(INFO) << "filename_raw_root: " << filename_raw_root;
+    if (save_raw_root)
+        LOG(INFO) << "filename_raw_root: " << filename_raw_root;
+    if (save_archive)
+        LOG(INFO) << "filename_archive: " << filename_archive;
+    if (load_archive)
+        LOG(INFO) << "Input is a hit archive";
     LOG(INFO) << "filename_parsed_root: " << filename_parsed_root;
     LOG(INFO) << "filename_analysis_root: " << filename_analysis_root;
+    LOG(INFO) << "decode_thread_num: " << decode_thread_num;
+    if (prefetch_read_num > 0)
+        LOG(INFO) << "prefetch_read_num: " << prefetch_read_num;
+    if (preview_fraction > 0) {
+        LOG(INFO) << "preview: " << preview_fraction * 100 << "% of the capture in " << preview_block_num << " blocks";
+        if (save_raw_root) {
+            LOG(WARNING) << "No raw rootfile is saved in preview mode";
+            save_raw_root = false;
+        }
+        save_archive = false;
+    }
+    if (load_archive && (preview_fraction > 0 || save_raw_root || save_archive)) {
+        LOG(WARNING) << "Preview, raw rootfile and archive output are not available for a hit archive input";
+        preview_fraction = 0;
+        save_raw_root = false;
+        save_archive = false;
+    }
+    // * the fused decode and parse runs on one reader thread, several decoding threads or the
+    // * packet index need the packet ranges decoded into the frame store first
+    bool decode_to_store = !load_archive && preview_fraction <= 0
+                        && (save_raw_root || save_archive || decode_thread_num > 1 || use_packet_index);
     
     
     bool save_to_rootfile = true;
@@ -92,23 +171,79 @@ int main(int argc, char** argv) {
 
     // * -------------------------------------------------------------------------------------------
     SJSV_pcapreader pcapreader(filename_pcap);
-    pcapreader.read_pcapfile();
-    pcapreader.test_decode_first_packet();
-    auto vec_len = pcapreader.full_decode_pcapfile();
-    LOG(INFO) << "Saving to raw rootfile ...";
-    if (pcapreader.save_to_rootfile(filename_raw_root))
-        LOG(INFO) << "Save to rootfile success";
-    else
-        LOG(ERROR) << "Save to rootfile fail";
+    if (filename_pcap.find(',') != std::string::npos) {
+        // * comma separated capture files are decoded as one run
+        std::vector<std::string> run_files;
+        std::stringstream run_files_stream(filename_pcap);
+        std::string run_file;
+        while (std::getline(run_files_stream, run_file, ','))
+            if (!run_file.empty())
+                run_files.push_back(run_file);
+        pcapreader.set_run_files(run_files);
+    }
+    pcapreader.set_thread_num(decode_thread_num);
+    pcapreader.set_packed_storage(true);
+    pcapreader.set_root_thread_num(decode_thread_num);
+    pcapreader.set_link_stats_dump_interval(link_stats_interval_s);
+    pcapreader.set_prefetch_read_num(prefetch_read_num);
+    if (!frame_format_name.empty()) {
+        if (!pcapreader.set_frame_format(frame_format_name))
+            return 1;
+    } else if (!load_archive && !pcapreader.probe_frame_format()) {
+        LOG(WARNING) << "Using the default frame format " << pcapreader.get_frame_format().name;
+    }
+    if (raw_root_compression == "lz4")
+        pcapreader.set_root_compression(ROOT::kLZ4, 4);
+    else if (raw_root_compression == "zstd")
+        pcapreader.set_root_compression(ROOT::kZSTD, 5);
+    else if (!raw_root_compression.empty())
+        LOG(WARNING) << "Unknown compression " << raw_root_compression << ", using ROOT default";
+    if (decode_to_store) {
+        if (use_packet_index)
+            pcapreader.load_packet_index();
+        auto vec_len = pcapreader.mmap_decode_pcapfile();
+        if (save_raw_root) {
+            LOG(INFO) << "Saving to raw rootfile ...";
+            if (pcapreader.save_to_rootfile(filename_raw_root))
+                LOG(INFO) << "Save to rootfile success";
+            else
+                LOG(ERROR) << "Save to rootfile fail";
+        }
+        if (save_archive) {
+            LOG(INFO) << "Saving to hit archive ...";
+            if (pcapreader.save_to_archive(filename_archive))
+                LOG(INFO) << "Save to hit archive success";
+            else
+                LOG(ERROR) << "Save to hit archive fail";
+        }
+    }
     // * -------------------------------------------------------------------------------------------
 
     // * -------------------------------------------------------------------------------------------
     SJSV_eventbuilder eventbuilder;
     eventbuilder.load_mapping_file(filename_mapping_csv);
-    eventbuilder.load_raw_data(filename_raw_root);
     eventbuilder.set_bcid_cycle(bcid_cycle);
     eventbuilder.set_tdc_slope(tdc_slope);
-    eventbuilder.parse_raw_data();
+    eventbuilder.set_base_fec_id(base_fec_id);
+    eventbuilder.set_time_sorted_parsing(time_sorted_parsing);
+    eventbuilder.set_reconstruction_thread_num(decode_thread_num);
+    if (load_archive) {
+        if (!eventbuilder.load_raw_data(filename_pcap))
+            return 1;
+        eventbuilder.parse_raw_data();
+    } else if (preview_fraction > 0) {
+        if (use_packet_index)
+            pcapreader.load_packet_index();
+        if (!eventbuilder.parse_pcap_sample(pcapreader, preview_fraction, preview_block_num))
+            return 1;
+    } else if (decode_to_store) {
+        // * the decoded frames are handed over directly, the raw rootfile is not read back
+        eventbuilder.load_raw_data(pcapreader.get_packed_frame_store());
+        eventbuilder.parse_raw_data();
+    } else {
+        // * decode and parse in one pass without materialising the raw frames
+        eventbuilder.parse_pcap_data(pcapreader);
+    }
     eventbuilder.reconstruct_event_list(reconstructed_threshold_time_ns);
     eventbuilder.show_first_event_info();
     LOG(INFO) << "Saving to parsed rootfile ...";
@@ -0,0 +1,187 @@
+#include <iostream>
+#include <csignal>
+#include <unistd.h>
+#include "TFile.h"
+#include "TH1I.h"
+#include "TH2I.h"
+#include "easylogging++.h"
+#include "SJSV_pcapreader.h"
+#include "SJSV_udpreceiver.h"
+
+void set_easylogger(); // set easylogging++ configurations
+
+INITIALIZE_EASYLOGGINGPP
+
+static std::atomic<bool> stop_requested(false);
+
+void handle_stop_signal(int) {
+    stop_requested.store(true);
+}
+
+int main(int argc, char** argv) {
+    START_EASYLOGGINGPP(argc, argv);
+    set_easylogger();
+
+    int listen_port = DAQ_DATA_SRC_PORT;
+    std::string bind_address = "0.0.0.0";
+    int64_t duration_s = -1;
+    int report_interval_s = 1;
+    uint32_t batch_size = UDP_RECV_BATCH_SIZE;
+    std::string filename_monitor_root = "";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:a:d:i:b:o:")) != -1){
+        switch (opt){
+            case 'p':
+                listen_port = std::stoi(optarg);
+                break;
+            case 'a':
+                bind_address = std::string(optarg);
+                break;
+            case 'd':
+                duration_s = std::stoll(optarg);
+                break;
+            case 'i':
+                report_interval_s = std::max(1, std::stoi(optarg));
+                break;
+            case 'b':
+                batch_size = std::stoul(optarg);
+                break;
+            case 'o':
+                filename_monitor_root = std::string(optarg);
+                break;
+            default:
+                LOG(ERROR) << "Wrong arguments!";
+                return 1;
+        }
+    }
+
+    LOG(INFO) << "listen: " << bind_address << ":" << listen_port;
+    if (duration_s >= 0)
+        LOG(INFO) << "duration_s: " << duration_s;
+    if (!filename_monitor_root.empty())
+        LOG(INFO) << "filename_monitor_root: " << filename_monitor_root;
+
+    signal(SIGINT,  handle_stop_signal);
+    signal(SIGTERM, handle_stop_signal);
+
+    // * -------------------------------------------------------------------------------------------
+    SJSV_pcapreader pcapreader;
+    SJSV_udpreceiver receiver(uint16_t(listen_port), bind_address);
+    receiver.set_batch_size(batch_size);
+    if (!receiver.open_socket())
+        return 1;
+
+    // * plain counters on the receive path, histograms are only filled when saving
+    // * every FEC has its own counters, allocated when its first packet arrives
+    const int channel_num = 32 * 64;
+    const int adc_num     = 1024;
+    std::array<std::vector<uint32_t>, LINK_FEC_NUM> fec_channel_adc_count;
+    uint64_t daq_frame_num = 0, timestamp_frame_num = 0;
+    uint64_t last_datagram_num = 0, last_byte_num = 0, last_daq_frame_num = 0;
+    uint64_t last_lost_packet_num = 0, last_out_of_order_num = 0;
+    SJSV_pcapreader::link_statistics link_stats;
+
+    SJSV_pcapreader::uni_frame frame_buf[FRAME_BATCH_SIZE];
+    auto monitor_payload = [&](const uint8_t* _payload, uint32_t _payload_len) {
+        auto _receive_time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        link_stats.add_packet(_payload, _payload_len, _receive_time_ns);
+        if (_payload_len <= LEN_RAW_HEADER_BYTE)
+            return;
+        auto _frame_data = _payload + LEN_RAW_HEADER_BYTE;
+        auto _fec_id = SJSV_pcapreader::get_payload_fec_id(_payload, _payload_len);
+        auto &channel_adc_count = fec_channel_adc_count[_fec_id];
+        if (channel_adc_count.empty())
+            channel_adc_count.resize(size_t(channel_num) * adc_num, 0);
+        uint32_t _frame_total = (_payload_len - LEN_RAW_HEADER_BYTE) / LEN_RAW_FRAME_BYTE;
+        for (uint32_t _batch_start = 0; _batch_start < _frame_total; _batch_start += FRAME_BATCH_SIZE) {
+            uint32_t _batch_len = std::min<uint32_t>(FRAME_BATCH_SIZE, _frame_total - _batch_start);
+            pcapreader.decode_frame_batch(_frame_data + _batch_start * LEN_RAW_FRAME_BYTE, _batch_len * LEN_RAW_FRAME_BYTE, frame_buf, _fec_id);
+            for (uint32_t i = 0; i < _batch_len; i++) {
+                auto &_frame = frame_buf[i];
+                if (!_frame.flag_daq) {
+                    timestamp_frame_num++;
+                    continue;
+                }
+                daq_frame_num++;
+                auto _channel = (_frame.vmm_id & 0x1F) * 64 + (_frame.channel & 0x3F);
+                channel_adc_count[size_t(_channel) * adc_num + (_frame.adc & 0x3FF)]++;
+            }
+        }
+    };
+
+    LOG(INFO) << "Monitoring, press Ctrl-C to stop ...";
+    auto start_time = std::chrono::steady_clock::now();
+    while (!stop_requested.load()) {
+        auto elapsed_s = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - start_time).count();
+        if (duration_s >= 0 && elapsed_s >= duration_s)
+            break;
+        int64_t interval_ms = int64_t(report_interval_s) * 1000;
+        if (duration_s >= 0)
+            interval_ms = std::min<int64_t>(interval_ms, (duration_s - elapsed_s) * 1000);
+        auto interval_start = std::chrono::steady_clock::now();
+        if (receiver.run(monitor_payload, stop_requested, interval_ms) < 0)
+            return 1;
+
+        auto &stats = receiver.get_statistics();
+        double interval_real_s = std::max(1e-3, std::chrono::duration<double>(std::chrono::steady_clock::now() - interval_start).count());
+        LOG(INFO) << "Rate: " << uint64_t((stats.datagram_num - last_datagram_num) / interval_real_s) << " pkt/s, "
+                  << (stats.byte_num - last_byte_num) / interval_real_s / 1e6 << " MB/s, "
+                  << uint64_t((daq_frame_num - last_daq_frame_num) / interval_real_s) << " hits/s"
+                  << ", lost " << link_stats.lost_packet_num - last_lost_packet_num
+                  << ", out of order " << link_stats.out_of_order_num - last_out_of_order_num
+                  << ", dropped " << stats.kernel_drop_num;
+        last_datagram_num     = stats.datagram_num;
+        last_byte_num         = stats.byte_num;
+        last_daq_frame_num    = daq_frame_num;
+        last_lost_packet_num  = link_stats.lost_packet_num;
+        last_out_of_order_num = link_stats.out_of_order_num;
+    }
+    receiver.close_socket();
+    receiver.log_statistics();
+    SJSV_pcapreader::log_link_statistics(link_stats);
+    LOG(INFO) << "Decoded " << daq_frame_num << " DAQ frames and " << timestamp_frame_num << " timestamp frames";
+    // * -------------------------------------------------------------------------------------------
+
+    if (!filename_monitor_root.empty()) {
+        LOG(INFO) << "Saving to monitor rootfile ...";
+        auto monitor_file = new TFile(filename_monitor_root.c_str(), "RECREATE");
+        for (int _fec = 0; _fec < LINK_FEC_NUM; _fec++) {
+            auto &channel_adc_count = fec_channel_adc_count[_fec];
+            if (channel_adc_count.empty())
+                continue;
+            auto _fec_str = std::to_string(_fec);
+            auto channel_hist = new TH1I(("channel_hits_fec" + _fec_str).c_str(), ("Hits per channel, FEC " + _fec_str + ";Channel;Hits").c_str(), channel_num, 0, channel_num);
+            auto channel_adc_hist = new TH2I(("channel_adc_fec" + _fec_str).c_str(), ("ADC per channel, FEC " + _fec_str + ";Channel;ADC").c_str(), channel_num, 0, channel_num, adc_num, 0, adc_num);
+            for (int _channel = 0; _channel < channel_num; _channel++) {
+                uint64_t _channel_hits = 0;
+                for (int _adc = 0; _adc < adc_num; _adc++) {
+                    auto _count = channel_adc_count[size_t(_channel) * adc_num + _adc];
+                    if (_count == 0)
+                        continue;
+                    channel_adc_hist->SetBinContent(_channel + 1, _adc + 1, _count);
+                    _channel_hits += _count;
+                }
+                channel_hist->SetBinContent(_channel + 1, _channel_hits);
+            }
+            channel_hist->Write();
+            channel_adc_hist->Write();
+        }
+        monitor_file->Close();
+        delete monitor_file;
+    }
+    return 0;
+}
+
+void set_easylogger(){
+    el::Configurations defaultConf;
+    defaultConf.setToDefault();
+    defaultConf.setGlobally(el::ConfigurationType::Format, "%datetime{%H:%m:%s}[%levshort] (%fbase) %msg");
+    defaultConf.set(el::Level::Info,    el::ConfigurationType::Format,
+        "%datetime{%H:%m:%s}[\033[1;34m%levshort\033[0m] (%fbase) %msg");
+    defaultConf.set(el::Level::Warning, el::ConfigurationType::Format,
+        "%datetime{%H:%m:%s}[\033[1;33m%levshort\033[0m] (%fbase) %msg");
+    defaultConf.set(el::Level::Error,   el::ConfigurationType::Format,
+        "%datetime{%H:%m:%s}[\033[1;31m%levshort\033[0m] (%fbase) %msg");
+    el::Loggers::reconfigureLogger("default", defaultConf);
+}
@@ -39,11 +39,8 @@ int main(int argc, char** argv) {
     // ! Create PCAP reader and read PCAP file into raw rootfile
     // * -------------------------------------------------------------------------------------------
     SJSV_pcapreader pcapreader(filename_pcap);
-    pcapreader.read_pcapfile();
-    pcapreader.test_decode_first_packet();
-    auto vec_len = pcapreader.full_decode_pcapfile();
-    LOG(INFO) << "Saving to raw rootfile ...";
-    if (pcapreader.save_to_rootfile(filename_raw_root))
+    LOG(INFO) << "Streaming to raw rootfile ...";
+    if (pcapreader.stream_to_rootfile(filename_raw_root))
         LOG(INFO) << "Save to rootfile success";
     else
         LOG(ERROR) << "Save to rootfile fail";
@@ -0,0 +1,225 @@
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "easylogging++.h"
+#include "SJSV_pcapreader.h"
+
+#define REPLAY_BATCH_SIZE        64
+#define REPLAY_MAX_DATAGRAM_BYTE 65507  // largest UDP payload over IPv4
+#define REPLAY_SPIN_WAIT_NS      200000  // sleep only for gaps longer than this, spin for the rest
+
+void set_easylogger(); // set easylogging++ configurations
+
+INITIALIZE_EASYLOGGINGPP
+
+// * Sends DAQ payloads in batches over a connected UDP socket
+// * Payloads are copied into a small pool because the reader only keeps them valid during the callback.
+class replay_sender {
+    public:
+        replay_sender(): sent_packet_num(0), sent_byte_num(0), failed_packet_num(0), socket_fd(-1), pending_num(0) {
+            pool_buffer.resize(size_t(REPLAY_BATCH_SIZE) * REPLAY_MAX_DATAGRAM_BYTE);
+            pool_len_vec.resize(REPLAY_BATCH_SIZE);
+        }
+
+        ~replay_sender() {
+            if (socket_fd >= 0)
+                close(socket_fd);
+        }
+
+        bool connect_socket(const std::string &_address, uint16_t _port) {
+            socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+            if (socket_fd < 0) {
+                LOG(ERROR) << "Cannot create UDP socket: " << strerror(errno);
+                return false;
+            }
+            sockaddr_in _target;
+            memset(&_target, 0, sizeof(_target));
+            _target.sin_family = AF_INET;
+            _target.sin_port   = htons(_port);
+            if (inet_pton(AF_INET, _address.c_str(), &_target.sin_addr) != 1) {
+                LOG(ERROR) << "Invalid target address " << _address;
+                return false;
+            }
+            if (connect(socket_fd, reinterpret_cast<sockaddr*>(&_target), sizeof(_target)) != 0) {
+                LOG(ERROR) << "Cannot connect to " << _address << ":" << _port << ": " << strerror(errno);
+                return false;
+            }
+            return true;
+        }
+
+        inline void enqueue(const uint8_t* _payload, uint32_t _payload_len) {
+            _payload_len = std::min<uint32_t>(_payload_len, REPLAY_MAX_DATAGRAM_BYTE);
+            memcpy(pool_buffer.data() + size_t(pending_num) * REPLAY_MAX_DATAGRAM_BYTE, _payload, _payload_len);
+            pool_len_vec[pending_num++] = _payload_len;
+            if (pending_num == REPLAY_BATCH_SIZE)
+                flush();
+        }
+
+        void flush() {
+            uint32_t _sent = 0;
+#ifdef __linux__
+            mmsghdr _msg_vec[REPLAY_BATCH_SIZE];
+            iovec   _iovec_vec[REPLAY_BATCH_SIZE];
+            memset(_msg_vec, 0, sizeof(mmsghdr) * pending_num);
+            for (uint32_t i = 0; i < pending_num; i++) {
+                _iovec_vec[i].iov_base = pool_buffer.data() + size_t(i) * REPLAY_MAX_DATAGRAM_BYTE;
+                _iovec_vec[i].iov_len  = pool_len_vec[i];
+                _msg_vec[i].msg_hdr.msg_iov    = &_iovec_vec[i];
+                _msg_vec[i].msg_hdr.msg_iovlen = 1;
+            }
+            while (_sent < pending_num) {
+                auto _result = sendmmsg(socket_fd, _msg_vec + _sent, pending_num - _sent, 0);
+                if (_result <= 0) {
+                    if (_result < 0 && errno == EINTR)
+                        continue;
+                    // * skip the datagram the kernel refused and carry on with the batch
+                    failed_packet_num++;
+                    _sent++;
+                    continue;
+                }
+                for (int i = 0; i < _result; i++)
+                    sent_byte_num += pool_len_vec[_sent + i];
+                sent_packet_num += _result;
+                _sent += _result;
+            }
+#else
+            for (; _sent < pending_num; _sent++) {
+                if (send(socket_fd, pool_buffer.data() + size_t(_sent) * REPLAY_MAX_DATAGRAM_BYTE, pool_len_vec[_sent], 0) < 0) {
+                    failed_packet_num++;
+                    continue;
+                }
+                sent_packet_num++;
+                sent_byte_num += pool_len_vec[_sent];
+            }
+#endif
+            pending_num = 0;
+        }
+
+        uint64_t sent_packet_num;
+        uint64_t sent_byte_num;
+        uint64_t failed_packet_num;
+
+    private:
+        int socket_fd;
+        uint32_t pending_num;
+        std::vector<uint8_t>  pool_buffer;
+        std::vector<uint32_t> pool_len_vec;
+};
+
+int main(int argc, char** argv) {
+    START_EASYLOGGINGPP(argc, argv);
+    set_easylogger();
+
+    std::string filename_pcap = "../data/Run030.pcap";
+    std::string target_address = "127.0.0.1";
+    int target_port = DAQ_DATA_SRC_PORT;
+    double speed_factor = 1.0;  // 1 - original timing, k - k times faster, 0 - as fast as possible
+    int loop_num = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:a:p:s:n:")) != -1){
+        switch (opt){
+            case 'd':
+                filename_pcap = std::string(optarg);
+                break;
+            case 'a':
+                target_address = std::string(optarg);
+                break;
+            case 'p':
+                target_port = std::stoi(optarg);
+                break;
+            case 's':
+                speed_factor = std::stod(optarg);
+                break;
+            case 'n':
+                loop_num = std::max(1, std::stoi(optarg));
+                break;
+            default:
+                LOG(ERROR) << "Wrong arguments!";
+                return 1;
+        }
+    }
+
+    LOG(INFO) << "filename_pcap: " << filename_pcap;
+    LOG(INFO) << "target: " << target_address << ":" << target_port;
+    if (speed_factor > 0)
+        LOG(INFO) << "speed_factor: " << speed_factor << "x original timing";
+    else
+        LOG(INFO) << "speed_factor: as fast as possible";
+    LOG(INFO) << "loop_num: " << loop_num;
+
+    // * -------------------------------------------------------------------------------------------
+    SJSV_pcapreader pcapreader(filename_pcap);
+    replay_sender sender;
+    if (!sender.connect_socket(target_address, uint16_t(target_port)))
+        return 1;
+
+    auto replay_start = std::chrono::steady_clock::now();
+    auto report_time = replay_start;
+    uint64_t report_packet_num = 0, report_byte_num = 0;
+    auto report_rate = [&](std::chrono::steady_clock::time_point _now) {
+        double _interval_s = std::chrono::duration<double>(_now - report_time).count();
+        LOG(INFO) << "Rate: " << uint64_t((sender.sent_packet_num - report_packet_num) / _interval_s) << " pkt/s, "
+                  << (sender.sent_byte_num - report_byte_num) / _interval_s / 1e6 << " MB/s";
+        report_time = _now;
+        report_packet_num = sender.sent_packet_num;
+        report_byte_num   = sender.sent_byte_num;
+    };
+
+    for (int _loop = 0; _loop < loop_num; _loop++) {
+        bool _first_packet = true;
+        uint64_t _first_capture_ns = 0;
+        std::chrono::steady_clock::time_point _loop_start;
+        auto _packet_num = pcapreader.for_each_daq_packet([&](uint64_t _capture_time_ns, const uint8_t* _payload, uint32_t _payload_len) {
+            auto _now = std::chrono::steady_clock::now();
+            if (_first_packet) {
+                _first_capture_ns = _capture_time_ns;
+                _loop_start = _now;
+                _first_packet = false;
+            }
+            if (speed_factor > 0 && _capture_time_ns > _first_capture_ns) {
+                // * packets already due are batched, a packet in the future flushes the batch and waits
+                auto _target = _loop_start + std::chrono::nanoseconds(int64_t((_capture_time_ns - _first_capture_ns) / speed_factor));
+                if (_target > _now) {
+                    sender.flush();
+                    if (_target - _now > std::chrono::nanoseconds(REPLAY_SPIN_WAIT_NS))
+                        std::this_thread::sleep_until(_target - std::chrono::nanoseconds(REPLAY_SPIN_WAIT_NS / 2));
+                    while (std::chrono::steady_clock::now() < _target) {}
+                    _now = std::chrono::steady_clock::now();
+                }
+            }
+            sender.enqueue(_payload, _payload_len);
+            if (_now - report_time >= std::chrono::seconds(1))
+                report_rate(_now);
+        });
+        sender.flush();
+        if (_packet_num < 0)
+            return 1;
+    }
+
+    auto replay_end = std::chrono::steady_clock::now();
+    double replay_s = std::chrono::duration<double>(replay_end - replay_start).count();
+    LOG(INFO) << "Sent " << sender.sent_packet_num << " packets (" << sender.sent_byte_num << " bytes) in " << replay_s << " s";
+    LOG(INFO) << "Average rate: " << uint64_t(sender.sent_packet_num / replay_s) << " pkt/s, "
+              << sender.sent_byte_num / replay_s / 1e6 << " MB/s";
+    if (sender.failed_packet_num > 0)
+        LOG(WARNING) << "Failed to send " << sender.failed_packet_num << " packets";
+    // * -------------------------------------------------------------------------------------------
+    return 0;
+}
+
+void set_easylogger(){
+    el::Configurations defaultConf;
+    defaultConf.setToDefault();
+    defaultConf.setGlobally(el::ConfigurationType::Format, "%datetime{%H:%m:%s}[%levshort] (%fbase) %msg");
+    defaultConf.set(el::Level::Info,    el::ConfigurationType::Format,
+        "%datetime{%H:%m:%s}[\033[1;34m%levshort\033[0m] (%fbase) %msg");
+    defaultConf.set(el::Level::Warning, el::ConfigurationType::Format,
+        "%datetime{%H:%m:%s}[\033[1;33m%levshort\033[0m] (%fbase) %msg");
+    defaultConf.set(el::Level::Error,   el::ConfigurationType::Format,
+        "%datetime{%H:%m:%s}[\033[1;31m%levshort\033[0m] (%fbase) %msg");
+    el::Loggers::reconfigureLogger("default", defaultConf);
+}
@@ -1,4 +1,12 @@
 #include "SJSV_eventbuilder.h"
+#include "SJSV_boundedqueue.h"
+#include "SJSV_hitarchive.h"
+
+#include <memory>
+#include <queue>
+#include <limits>
+#include <thread>
+#include <atomic>
 
 SJSV_eventbuilder::SJSV_eventbuilder():
     is_raw_data_valid(false),
@@ -6,17 +14,20 @@ SJSV_eventbuilder::SJSV_eventbuilder():
     is_pedestal_valid(false),
     pedestal_subtraction_enabled(false),
     bcid_cycle(25),
-    tdc_slope(25) {
-    vec_frame_ptr = new std::vector<SJSV_pcapreader::uni_frame>;
+    tdc_slope(25),
+    base_fec_id(PARSE_BASE_FEC_ID),
+    time_sorted_parsing_enabled(false),
+    reconstruction_thread_num(1) {
+    raw_frame_store_ptr = new SJSV_pcapreader::packed_frame_store;
     vec_parsed_frame_ptr = new std::vector<parsed_frame>;
     vec_pedestal_ptr = new std::vector<uint16_t>;
     mapping_info_ptr = new channel_mapping_info;
-    vec_parsed_event_ptr = new std::vector<parsed_event>;
+    parsed_event_store_ptr = new parsed_event_store;
 }
 
 SJSV_eventbuilder::~SJSV_eventbuilder() {
-    if (vec_frame_ptr != nullptr) {
-        delete vec_frame_ptr;
+    if (raw_frame_store_ptr != nullptr) {
+        delete raw_frame_store_ptr;
     }
     if (vec_parsed_frame_ptr != nullptr) {
         delete vec_parsed_frame_ptr;
@@ -27,8 +38,8 @@ SJSV_eventbuilder::~SJSV_eventbuilder() {
     if (mapping_info_ptr != nullptr) {
         delete mapping_info_ptr;
     }
-    if (vec_parsed_event_ptr != nullptr) {
-        delete vec_parsed_event_ptr;
+    if (parsed_event_store_ptr != nullptr) {
+        delete parsed_event_store_ptr;
     }
 }
 
@@ -37,6 +48,21 @@ bool SJSV_eventbuilder::load_raw_data(const std::string &_filename_str){
         LOG(ERROR) << "Filename is empty";
         return false;
     }
+
+    if (SJSV_hitarchive::is_archive_file(_filename_str)) {
+        SJSV_hitarchive _archive;
+        if (!_archive.open(_filename_str))
+            return false;
+        if (is_parsed_data_valid) {
+            raw_frame_store_ptr->clear();
+            is_parsed_data_valid = false;
+        }
+        if (!_archive.load_frames(*raw_frame_store_ptr))
+            return false;
+        LOG(INFO) << "Loaded " << _archive.get_frame_num() << " frames from " << _filename_str;
+        is_raw_data_valid = true;
+        return true;
+    }
     
     TFile *rootfile = new TFile(_filename_str.c_str(), "READ");
     if (rootfile->IsZombie()) {
@@ -50,7 +76,7 @@ bool SJSV_eventbuilder::load_raw_data(const std::string &_filename_str){
     }
 
     if (is_parsed_data_valid) {
-        vec_frame_ptr->clear();
+        raw_frame_store_ptr->clear();
         is_parsed_data_valid = false;
     }
 
@@ -63,6 +89,7 @@ bool SJSV_eventbuilder::load_raw_data(const std::string &_filename_str){
     uint8_t  _tdc;
     uint64_t _timestamp;
     bool    _flag_daq;
+    uint8_t  _fec_id = 0;
 
     tree->SetBranchAddress("offset", &_offset);
     tree->SetBranchAddress("vmm_id", &_vmm_id);
@@ -73,8 +100,12 @@ bool SJSV_eventbuilder::load_raw_data(const std::string &_filename_str){
     tree->SetBranchAddress("tdc", &_tdc);
     tree->SetBranchAddress("timestamp", &_timestamp);
     tree->SetBranchAddress("flag_daq", &_flag_daq);
+    // * files written before the FEC demultiplexing have no fec_id branch
+    if (tree->GetBranch("fec_id") != nullptr)
+        tree->SetBranchAddress("fec_id", &_fec_id);
 
     int64_t nentries = tree->GetEntries();
+    raw_frame_store_ptr->reserve(raw_frame_store_ptr->hit_word_vec.size() + nentries);
 
     for (int64_t ientry = 0; ientry < nentries; ientry++) {
         tree->GetEntry(ientry);
@@ -88,15 +119,34 @@ bool SJSV_eventbuilder::load_raw_data(const std::string &_filename_str){
         _frame.tdc = _tdc;
         _frame.timestamp = _timestamp;
         _frame.flag_daq = _flag_daq;
-        vec_frame_ptr->push_back(_frame);
+        _frame.fec_id = _fec_id;
+        raw_frame_store_ptr->push_back(_frame);
     }
 
     rootfile->Close();
+    raw_frame_store_ptr->hit_word_vec.shrink_to_fit();
     LOG(INFO) << "Loaded " << nentries << " entries from " << _filename_str;
     is_raw_data_valid = true;
     return true;
 }
 
+bool SJSV_eventbuilder::load_raw_data(const SJSV_pcapreader::packed_frame_store &_frame_store) {
+    if (_frame_store.empty()) {
+        LOG(ERROR) << "Frame store is empty";
+        return false;
+    }
+
+    if (is_parsed_data_valid) {
+        raw_frame_store_ptr->clear();
+        is_parsed_data_valid = false;
+    }
+
+    raw_frame_store_ptr->append(_frame_store);
+    LOG(INFO) << "Loaded " << _frame_store.size() << " frames from packed frame store";
+    is_raw_data_valid = true;
+    return true;
+}
+
 SJSV_eventbuilder::parsed_frame SJSV_eventbuilder::parse_frame(const SJSV_pcapreader::uni_frame &_frame, uint64_t _offset_timestamp) {
     parsed_frame _parsed_frame;
     if (!_frame.flag_daq) {
@@ -115,7 +165,7 @@ bool SJSV_eventbuilder::parse_raw_data(){
         return false;
     }
 
-    if (vec_frame_ptr->empty()) {
+    if (raw_frame_store_ptr->empty()) {
         LOG(ERROR) << "Raw data is empty";
         return false;
     }
@@ -132,39 +182,283 @@ bool SJSV_eventbuilder::parse_raw_data(){
 
     vec_parsed_frame_ptr = new std::vector<parsed_frame>;
 
-    auto _frame_num = vec_frame_ptr->size();
-    uint64_t _timestamp_start = 0;
-    uint64_t _timestamp_current = 0;
-    bool _first_timestamp_found = false;
-    uint32_t _skipped_daq_frame_count = 0;
-    uint32_t _time_frame_count = 0;
-
-    for (auto i=0; i< _frame_num; i++) {
-        auto _frame = vec_frame_ptr->at(i);
-        if (_frame.flag_daq == 1) {
-            if (!_first_timestamp_found) {
-                _skipped_daq_frame_count++;
+    // * count the hits of every FEC to size the streams and find the FECs present
+    std::array<uint64_t, LINK_FEC_NUM> _fec_hit_num = {};
+    uint32_t _fec_mask = 0;
+    for (auto _word : raw_frame_store_ptr->hit_word_vec)
+        _fec_hit_num[SJSV_pcapreader::packed_frame_store::hit_fec_id(_word)]++;
+    for (auto &_marker : raw_frame_store_ptr->marker_vec)
+        _fec_mask |= 1u << SJSV_pcapreader::packed_frame_store::marker_fec_id(_marker);
+    for (int _fec = 0; _fec < LINK_FEC_NUM; _fec++)
+        if (_fec_hit_num[_fec] > 0)
+            _fec_mask |= 1u << _fec;
+
+    parse_state _state;
+    for (int _fec = 0; _fec < LINK_FEC_NUM; _fec++)
+        _state.fec_states[_fec].frame_vec.reserve(_fec_hit_num[_fec]);
+
+    if ((_fec_mask & (_fec_mask - 1)) == 0) {
+        for (auto _frame : *raw_frame_store_ptr)
+            parse_next_frame(_frame, _state);
+    } else {
+        // * the store is split by FEC once, then one thread parses each FEC store
+        std::array<SJSV_pcapreader::packed_frame_store, LINK_FEC_NUM> _fec_stores;
+        for (int _fec = 0; _fec < LINK_FEC_NUM; _fec++)
+            _fec_stores[_fec].reserve(_fec_hit_num[_fec]);
+        raw_frame_store_ptr->split_by_fec(_fec_stores);
+
+        std::vector<std::thread> _workers;
+        for (int _fec = 0; _fec < LINK_FEC_NUM; _fec++) {
+            if (((_fec_mask >> _fec) & 0x1) == 0)
                 continue;
+            _workers.emplace_back([this, _fec, &_state, &_fec_stores]() {
+                auto &_fec_state = _state.fec_states[_fec];
+                for (auto _frame : _fec_stores[_fec])
+                    parse_next_frame(_frame, _fec_state);
+                _fec_stores[_fec].release();
+            });
+        }
+        for (auto &_worker : _workers)
+            _worker.join();
+    }
+
+    return finalize_parse(_state);
+}
+
+bool SJSV_eventbuilder::finalize_parse(parse_state &_state) {
+    std::vector<int> _fec_vec;
+    uint64_t _global_timestamp_start = UINT64_MAX;
+    for (int _fec = 0; _fec < LINK_FEC_NUM; _fec++) {
+        auto &_fec_state = _state.fec_states[_fec];
+        if (!_fec_state.first_timestamp_found)
+            continue;
+        _fec_vec.push_back(_fec);
+        _global_timestamp_start = std::min(_global_timestamp_start, _fec_state.timestamp_start);
+    }
+
+    // * hits still waiting for a later timestamp are final now
+    if (time_sorted_parsing_enabled) {
+        for (auto _fec : _fec_vec)
+            release_vmm_queues(std::numeric_limits<Double_t>::infinity(), _state.fec_states[_fec]);
+    }
+
+    // * shift every FEC into the channel range of its id and onto the common time axis,
+    // * a lone FEC keeps the channels of the mapping whatever its id
+    size_t _frame_total = 0;
+    bool _is_base_range_used = false;
+    for (size_t _slot = 0; _slot < _fec_vec.size(); _slot++) {
+        auto &_fec_state = _state.fec_states[_fec_vec[_slot]];
+        Int_t    _channel_offset = get_fec_channel_offset(_fec_vec[_slot], _fec_vec.size());
+        if (_fec_vec.size() > 1 && _channel_offset == 0) {
+            if (_is_base_range_used)
+                LOG(WARNING) << "FEC " << _fec_vec[_slot] << " shares the unified channels from 0 with another FEC";
+            _is_base_range_used = true;
+        }
+        Double_t _time_offset    = double(_fec_state.timestamp_start - _global_timestamp_start) * double(bcid_cycle);
+        if (_channel_offset != 0 || _time_offset != 0) {
+            for (auto &_frame : _fec_state.frame_vec) {
+                _frame.uni_channel += _channel_offset;
+                _frame.time_ns     += _time_offset;
             }
-            auto _timestamp_offset = _timestamp_current - _timestamp_start;
-            auto _parsed_frame = parse_frame(_frame, _timestamp_offset);
-            auto _parsed_frame_new = new parsed_frame(_parsed_frame);
-            vec_parsed_frame_ptr->push_back(*_parsed_frame_new);
-        } else {
-            _time_frame_count++;
-            if (!_first_timestamp_found) {
-                _timestamp_start = _frame.timestamp;
-                _first_timestamp_found = true;
+        }
+        _frame_total += _fec_state.frame_vec.size();
+        if (_fec_vec.size() > 1)
+            LOG(INFO) << "FEC " << _fec_vec[_slot] << ": " << _fec_state.frame_vec.size() << " frames, uni_channel from " << _channel_offset;
+    }
+
+    if (_fec_vec.size() == 1 && vec_parsed_frame_ptr->empty()) {
+        vec_parsed_frame_ptr->swap(_state.fec_states[_fec_vec[0]].frame_vec);
+    } else {
+        // * interleave the streams by time, the order inside a stream is kept
+        vec_parsed_frame_ptr->reserve(vec_parsed_frame_ptr->size() + _frame_total);
+        std::vector<size_t> _next_vec(_fec_vec.size(), 0);
+        while (true) {
+            int _pick = -1;
+            for (size_t _slot = 0; _slot < _fec_vec.size(); _slot++) {
+                auto &_frame_vec = _state.fec_states[_fec_vec[_slot]].frame_vec;
+                if (_next_vec[_slot] >= _frame_vec.size())
+                    continue;
+                if (_pick < 0 || _frame_vec[_next_vec[_slot]].time_ns < _state.fec_states[_fec_vec[_pick]].frame_vec[_next_vec[_pick]].time_ns)
+                    _pick = int(_slot);
             }
-            _timestamp_current = _frame.timestamp;
+            if (_pick < 0)
+                break;
+            vec_parsed_frame_ptr->push_back(_state.fec_states[_fec_vec[_pick]].frame_vec[_next_vec[_pick]++]);
         }
+        for (auto _fec : _fec_vec)
+            std::vector<parsed_frame>().swap(_state.fec_states[_fec].frame_vec);
     }
 
+    log_parse_state(_state);
+    if (vec_parsed_frame_ptr->empty())
+        return false;
+    is_parsed_data_valid = true;
+    return true;
+}
+
+void SJSV_eventbuilder::log_parse_state(const parse_state &_state) {
+    uint64_t _skipped_daq_frame_count = 0, _time_frame_count = 0, _late_frame_count = 0;
+    for (auto &_fec_state : _state.fec_states) {
+        _skipped_daq_frame_count += _fec_state.skipped_daq_frame_count;
+        _time_frame_count        += _fec_state.time_frame_count;
+        _late_frame_count        += _fec_state.late_frame_count;
+    }
     LOG(INFO) << vec_parsed_frame_ptr->size() << " frames parsed";
     LOG(INFO) << _skipped_daq_frame_count << " DAQ frames skipped";
     LOG(INFO) << _time_frame_count << " time frames found";
+    if (_late_frame_count > 0)
+        LOG(WARNING) << _late_frame_count << " frames arrived after later frames were released, the time order is broken";
+}
 
-    is_parsed_data_valid = true;
+void SJSV_eventbuilder::release_vmm_queues(Double_t _release_time_ns, fec_parse_state &_state) {
+    // * k-way merge over the queue heads, ties go to the lower VMM id
+    typedef std::pair<Double_t, int> queue_head;
+    std::priority_queue<queue_head, std::vector<queue_head>, std::greater<queue_head>> _heads;
+    for (int _vmm = 0; _vmm < VMM_PER_FEC; _vmm++) {
+        auto &_queue = _state.vmm_queues[_vmm];
+        if (!_queue.empty() && _queue.front().time_ns < _release_time_ns)
+            _heads.push({_queue.front().time_ns, _vmm});
+    }
+    while (!_heads.empty()) {
+        int _vmm = _heads.top().second;
+        _heads.pop();
+        auto &_queue = _state.vmm_queues[_vmm];
+        auto &_frame = _queue.front();
+        if (!_state.frame_vec.empty() && _frame.time_ns < _state.released_time_ns)
+            _state.late_frame_count++;
+        _state.released_time_ns = _frame.time_ns;
+        _state.frame_vec.push_back(_frame);
+        _queue.pop_front();
+        if (!_queue.empty() && _queue.front().time_ns < _release_time_ns)
+            _heads.push({_queue.front().time_ns, _vmm});
+    }
+}
+
+uint32_t SJSV_eventbuilder::parse_daq_payload(const uint8_t* _payload, uint32_t _payload_len, SJSV_pcapreader &_pcapreader, parse_state &_state) {
+    if (_payload == nullptr || _payload_len <= LEN_RAW_HEADER_BYTE)
+        return 0;
+    auto _fec_id = SJSV_pcapreader::get_payload_fec_id(_payload, _payload_len);
+    return parse_daq_payload(_payload, _payload_len, _pcapreader, _state.fec_states[_fec_id]);
+}
+
+uint32_t SJSV_eventbuilder::parse_daq_payload(const uint8_t* _payload, uint32_t _payload_len, SJSV_pcapreader &_pcapreader, fec_parse_state &_state) {
+    if (_payload == nullptr || _payload_len <= LEN_RAW_HEADER_BYTE)
+        return 0;
+
+    // * frames only live in this small buffer between decoding and parsing
+    SJSV_pcapreader::uni_frame _frame_buf[FRAME_BATCH_SIZE];
+    auto _fec_id = SJSV_pcapreader::get_payload_fec_id(_payload, _payload_len);
+    auto _frame_data = _payload + LEN_RAW_HEADER_BYTE;
+    uint32_t _frame_total = (_payload_len - LEN_RAW_HEADER_BYTE) / LEN_RAW_FRAME_BYTE;
+    for (uint32_t _batch_start = 0; _batch_start < _frame_total; _batch_start += FRAME_BATCH_SIZE) {
+        uint32_t _batch_len = std::min<uint32_t>(FRAME_BATCH_SIZE, _frame_total - _batch_start);
+        _pcapreader.decode_frame_batch(_frame_data + _batch_start * LEN_RAW_FRAME_BYTE, _batch_len * LEN_RAW_FRAME_BYTE, _frame_buf, _fec_id);
+        for (uint32_t i = 0; i < _batch_len; i++)
+            parse_next_frame(_frame_buf[i], _state);
+    }
+    return _frame_total;
+}
+
+// * Payloads of one FEC copied out of the reader, handed to the parsing worker of the FEC
+struct payload_batch {
+    std::vector<uint8_t>  byte_vec;
+    std::vector<uint32_t> len_vec;
+};
+
+bool SJSV_eventbuilder::parse_pcap_data(SJSV_pcapreader &_pcapreader) {
+    if (is_parsed_data_valid) {
+        LOG(INFO) << "Parsed data is valid, deleting old data";
+        vec_parsed_frame_ptr->clear();
+        is_parsed_data_valid = false;
+    }
+
+    // * the reader demultiplexes the payloads by FEC id. The first FEC seen is decoded and parsed
+    // * in place on the reader thread, so a single-FEC capture is never copied; payloads of further
+    // * FECs are copied into batches, each FEC is decoded and parsed by its own worker.
+    parse_state _state;
+    int _inline_fec = -1;
+    std::array<std::unique_ptr<SJSV_boundedqueue<payload_batch>>, LINK_FEC_NUM> _queues;
+    std::array<payload_batch, LINK_FEC_NUM> _pending;
+    std::vector<std::thread> _workers;
+    auto _flush = [&](uint8_t _fec) {
+        if (_pending[_fec].len_vec.empty())
+            return;
+        if (!_queues[_fec]) {
+            _queues[_fec].reset(new SJSV_boundedqueue<payload_batch>(PARSE_PAYLOAD_QUEUE_LEN));
+            _workers.emplace_back([this, _fec, &_queues, &_state, &_pcapreader]() {
+                auto &_fec_state = _state.fec_states[_fec];
+                payload_batch _batch;
+                while (_queues[_fec]->pop(_batch)) {
+                    size_t _byte_pos = 0;
+                    for (auto _len : _batch.len_vec) {
+                        parse_daq_payload(_batch.byte_vec.data() + _byte_pos, _len, _pcapreader, _fec_state);
+                        _byte_pos += _len;
+                    }
+                }
+            });
+        }
+        _queues[_fec]->push(std::move(_pending[_fec]));
+        _pending[_fec] = payload_batch();
+    };
+
+    auto _packet_num = _pcapreader.for_each_daq_payload([&](const uint8_t* _payload, uint32_t _payload_len) {
+        if (_payload_len <= LEN_RAW_HEADER_BYTE)
+            return;
+        auto _fec = SJSV_pcapreader::get_payload_fec_id(_payload, _payload_len);
+        if (_inline_fec < 0)
+            _inline_fec = _fec;
+        if (_fec == _inline_fec) {
+            parse_daq_payload(_payload, _payload_len, _pcapreader, _state.fec_states[_fec]);
+            return;
+        }
+        auto &_batch = _pending[_fec];
+        if (_batch.byte_vec.empty())
+            _batch.byte_vec.reserve(PARSE_PAYLOAD_BATCH_BYTE);
+        _batch.byte_vec.insert(_batch.byte_vec.end(), _payload, _payload + _payload_len);
+        _batch.len_vec.push_back(_payload_len);
+        if (_batch.byte_vec.size() >= PARSE_PAYLOAD_BATCH_BYTE)
+            _flush(_fec);
+    });
+    for (uint8_t _fec = 0; _fec < LINK_FEC_NUM; _fec++) {
+        _flush(_fec);
+        if (_queues[_fec])
+            _queues[_fec]->close();
+    }
+    for (auto &_worker : _workers)
+        _worker.join();
+    if (_packet_num < 0)
+        return false;
+
+    if (!finalize_parse(_state)) {
+        LOG(ERROR) << "No frame parsed";
+        return false;
+    }
+    return true;
+}
+
+bool SJSV_eventbuilder::parse_pcap_sample(SJSV_pcapreader &_pcapreader, double _fraction, int _block_num) {
+    if (is_parsed_data_valid) {
+        LOG(INFO) << "Parsed data is valid, deleting old data";
+        vec_parsed_frame_ptr->clear();
+        is_parsed_data_valid = false;
+    }
+
+    // * the sample is small, it is parsed on the reader thread
+    parse_state _state;
+    auto _packet_num = _pcapreader.for_each_sampled_payload(_fraction, _block_num,
+        [&](const uint8_t* _payload, uint32_t _payload_len) {
+            parse_daq_payload(_payload, _payload_len, _pcapreader, _state);
+        },
+        [&](int) {
+            _state.resync();
+        });
+    if (_packet_num < 0)
+        return false;
+
+    if (!finalize_parse(_state)) {
+        LOG(ERROR) << "No frame parsed";
+        return false;
+    }
     return true;
 }
 
@@ -558,44 +852,23 @@ std::vector<uint16_t> SJSV_eventbuilder::load_pedestal_csv(const std::string &_f
 }
 
 bool SJSV_eventbuilder::is_frame_HG(const parsed_frame &_frame){
-    auto _uni_channel = _frame.uni_channel;
-    auto _vec_uni_channel = mapping_info_ptr->uni_channel_array;
-    auto _vec_Gain = mapping_info_ptr->is_HG_array;
-    auto _vec_index = std::find(_vec_uni_channel.begin(), _vec_uni_channel.end(), _uni_channel);
-    if (_vec_index == _vec_uni_channel.end()) {
-        // LOG(ERROR) << "Cannot find uni channel " << _uni_channel << " in mapping info";
-        return false;
-    }
-    if (mapping_info_ptr->is_HG_array.at(std::distance(_vec_uni_channel.begin(), _vec_index)))
-        return true;
-    else
-        return false;
-    auto _index = std::distance(_vec_uni_channel.begin(), _vec_index);
-    return _vec_Gain.at(_index);
+    auto _entry = mapping_info_ptr->lookup(_frame.uni_channel);
+    return _entry != nullptr && _entry->is_HG;
 }
 
 std::vector<Double_t> SJSV_eventbuilder::get_frame_coord(const parsed_frame &_frame){
-    std::vector<Double_t> _frame_coord = {-1, -1};
-    auto _uni_channel = _frame.uni_channel;
-    auto _vec_uni_channel = mapping_info_ptr->uni_channel_array;
-    auto _vec_x_coord = mapping_info_ptr->x_coords_array;
-    auto _vec_y_coord = mapping_info_ptr->y_coords_array;
-    auto _vec_index = std::find(_vec_uni_channel.begin(), _vec_uni_channel.end(), _uni_channel);
-    if (_vec_index == _vec_uni_channel.end()) {
-        // LOG(ERROR) << "Cannot find uni channel " << _uni_channel << " in mapping info";
-        return _frame_coord;
-    }
-    auto _index = std::distance(_vec_uni_channel.begin(), _vec_index);
-    _frame_coord.at(0) = _vec_x_coord.at(_index);
-    _frame_coord.at(1) = _vec_y_coord.at(_index);
-    return _frame_coord;
+    auto _entry = mapping_info_ptr->lookup(_frame.uni_channel);
+    if (_entry == nullptr)
+        return {-1, -1};
+    return {_entry->x_coord, _entry->y_coord};
 }
 
 
 std::vector<Double_t> SJSV_eventbuilder::get_event_adc_sum(bool _is_HG){
     std::vector<Double_t> _vec_event_adc_sum;
     if (_is_HG){
-        for (auto _event: *vec_parsed_event_ptr) {
+        for (size_t i = 0; i < parsed_event_store_ptr->size(); i++) {
+            auto _event = parsed_event_store_ptr->at(i);
             Double_t _adc_sum = 0;
             for (auto _frame_ptr : _event.frames_ptr) {
                 if (is_frame_HG(*_frame_ptr))
@@ -604,7 +877,8 @@ std::vector<Double_t> SJSV_eventbuilder::get_event_adc_sum(bool _is_HG){
             _vec_event_adc_sum.push_back(_adc_sum);
         }
     } else {
-        for (auto _event: *vec_parsed_event_ptr) {
+        for (size_t i = 0; i < parsed_event_store_ptr->size(); i++) {
+            auto _event = parsed_event_store_ptr->at(i);
             Double_t _adc_sum = 0;
             for (auto _frame_ptr : _event.frames_ptr) {
                 if (!is_frame_HG(*_frame_ptr))
@@ -740,9 +1014,34 @@ SJSV_eventbuilder::channel_mapping_info SJSV_eventbuilder::generate_mapping_coor
             _res.cell_size_array.push_back(7);
         }
     }
+
+    build_channel_lut(_res, _raw_mapping_info);
     return _res;
 }
 
+void SJSV_eventbuilder::build_channel_lut(channel_mapping_info &_mapping_info, const raw_mapping_info &_raw_mapping_info) {
+    Int_t _max_uni_channel = -1;
+    for (auto _uni_channel : _mapping_info.uni_channel_array)
+        _max_uni_channel = std::max(_max_uni_channel, _uni_channel);
+    _mapping_info.channel_lut.assign(_max_uni_channel + 1, channel_lut_entry());
+
+    for (size_t i = 0; i < _mapping_info.uni_channel_array.size(); i++) {
+        auto _uni_channel = _mapping_info.uni_channel_array[i];
+        if (_uni_channel < 0 || _mapping_info.channel_lut[_uni_channel].is_mapped)
+            continue;
+        auto &_entry = _mapping_info.channel_lut[_uni_channel];
+        auto _module = _raw_mapping_info.module_num_array[i];
+        _entry.x_coord    = _mapping_info.x_coords_array[i];
+        _entry.y_coord    = _mapping_info.y_coords_array[i];
+        _entry.cell_size  = _mapping_info.cell_size_array[i];
+        _entry.module     = _module;
+        // * the central module has 7 cells per row, the others 5
+        _entry.cell_index = _raw_mapping_info.row_array[i] * (_module == 4 ? 7 : 5) + _raw_mapping_info.col_array[i];
+        _entry.is_HG      = _mapping_info.is_HG_array[i];
+        _entry.is_mapped  = true;
+    }
+}
+
 bool SJSV_eventbuilder::load_mapping_file(const std::string &_filename_str){
     auto _raw_mapping_info = this->read_mapping_csv_file(_filename_str);
     auto _channel_mapping_info = this->generate_mapping_coordinates(_raw_mapping_info);
@@ -750,26 +1049,32 @@ bool SJSV_eventbuilder::load_mapping_file(const std::string &_filename_str){
         LOG(ERROR) << "Channel mapping info is empty";
         return false;
     }
-    this->mapping_info_ptr = new channel_mapping_info(_channel_mapping_info);
+    *mapping_info_ptr = std::move(_channel_mapping_info);
     LOG(INFO) << "Loaded mapping file: " << _filename_str;
     return true;
 }
 
 std::pair<Double_t, Double_t> SJSV_eventbuilder::frame_position(const parsed_frame &_frame, const SJSV_eventbuilder::channel_mapping_info &_mapping_inf){
-    auto _res = std::pair<Double_t, Double_t>();
-    auto _uni_channel = _frame.uni_channel;
-    auto _vec_uni_channel = _mapping_inf.uni_channel_array;
-    auto _vec_x_coord = _mapping_inf.x_coords_array;
-    auto _vec_y_coord = _mapping_inf.y_coords_array;
-    auto _vec_index = std::find(_vec_uni_channel.begin(), _vec_uni_channel.end(), _uni_channel);
-    if (_vec_index == _vec_uni_channel.end()) {
-        // LOG(ERROR) << "Cannot find uni channel " << _uni_channel << " in mapping info";
-        return _res;
+    auto _entry = _mapping_inf.lookup(_frame.uni_channel);
+    if (_entry == nullptr)
+        return std::pair<Double_t, Double_t>();
+    return {_entry->x_coord, _entry->y_coord};
+}
+
+void SJSV_eventbuilder::append_mapped_frame(mapped_event &_mapped_event, const parsed_frame &_frame, const channel_mapping_info &_mapping_info) {
+    auto _entry = _mapping_info.lookup(_frame.uni_channel);
+    if (_entry == nullptr)
+        return;
+    _mapped_event.x_coords_array.push_back(_entry->x_coord);
+    _mapped_event.y_coords_array.push_back(_entry->y_coord);
+    _mapped_event.cell_size_array.push_back(_entry->cell_size);
+    if (_entry->is_HG) {
+        _mapped_event.value_array.push_back(_frame.adc);
+        _mapped_event.value_LG_array.push_back(-1);
+    } else {
+        _mapped_event.value_array.push_back(-1);
+        _mapped_event.value_LG_array.push_back(_frame.adc);
     }
-    auto _index = std::distance(_vec_uni_channel.begin(), _vec_index);
-    _res.first = _vec_x_coord.at(_index);
-    _res.second = _vec_y_coord.at(_index);
-    return _res;
 }
 
 SJSV_eventbuilder::mapped_event SJSV_eventbuilder::map_event(const std::vector<SJSV_eventbuilder::parsed_frame> &_vec_parsed_frame, const SJSV_eventbuilder::channel_mapping_info &_mapping_info){
@@ -783,49 +1088,26 @@ SJSV_eventbuilder::mapped_event SJSV_eventbuilder::map_event(const std::vector<S
         return _res;
     }
 
-    auto _vec_uni_channel = _mapping_info.uni_channel_array;
-    auto _vec_x_coords  = _mapping_info.x_coords_array;
-    auto _vec_y_coords  = _mapping_info.y_coords_array;
-    auto _vec_cell_size = _mapping_info.cell_size_array;
-    auto _vec_Gain = _mapping_info.is_HG_array;
-
-    for (auto i=0; i<_vec_parsed_frame.size(); i++) {
-        auto _parsed_frame = _vec_parsed_frame.at(i);
-        auto _uni_channel = _parsed_frame.uni_channel;
-        auto _adc = _parsed_frame.adc;
-
-        int _index = std::find(_vec_uni_channel.begin(), _vec_uni_channel.end(), _uni_channel) - _vec_uni_channel.begin();
-
-        if (_index == _vec_uni_channel.size()) {
-            //LOG(ERROR) << "Cannot find channel " << _uni_channel << " in mapping info";
-            continue;
-        }
-
-        auto _x_coord = _vec_x_coords.at(_index);
-        auto _y_coord = _vec_y_coords.at(_index);
-        auto _cell_size = _vec_cell_size.at(_index);
-
-        _res.x_coords_array.push_back(_x_coord);
-        _res.y_coords_array.push_back(_y_coord);
-        _res.cell_size_array.push_back(_cell_size);
-        if (_vec_Gain.at(_index)){
-            _res.value_array.push_back(_adc);
-            _res.value_LG_array.push_back(-1);
-        } else {
-            _res.value_array.push_back(-1);
-            _res.value_LG_array.push_back(_adc);
-        }
-    }
-
+    for (auto &_parsed_frame : _vec_parsed_frame)
+        append_mapped_frame(_res, _parsed_frame, _mapping_info);
     return _res;
 }
 
 SJSV_eventbuilder::mapped_event SJSV_eventbuilder::map_event(const SJSV_eventbuilder::parsed_event &_parsed_event, const SJSV_eventbuilder::channel_mapping_info &_mapping_info){
-    std::vector<SJSV_eventbuilder::parsed_frame> _adapter_vec_parsed_frame;
-    for (auto _parsed_frame : _parsed_event.frames_ptr) {
-        _adapter_vec_parsed_frame.push_back(*_parsed_frame);
+    auto _res = SJSV_eventbuilder::mapped_event();
+    if (_parsed_event.frames_ptr.empty()) {
+        LOG(ERROR) << "Parsed frame vector is empty";
+        return _res;
+    }
+    if (_mapping_info.uni_channel_array.empty()) {
+        LOG(ERROR) << "Mapping info is empty";
+        return _res;
     }
-    return map_event(_adapter_vec_parsed_frame, _mapping_info);
+
+    // * the frames are mapped through their pointers, no copy of the event is made
+    for (auto _parsed_frame : _parsed_event.frames_ptr)
+        append_mapped_frame(_res, *_parsed_frame, _mapping_info);
+    return _res;
 }
 
 TH2D* SJSV_eventbuilder::quick_plot_mapped_event(const mapped_event &_mapped_event, Double_t _max_adc){
@@ -1108,9 +1390,9 @@ bool SJSV_eventbuilder::reconstruct_event(Double_t _threshold_time_ns){
         LOG(ERROR) << "Threshold time is negative";
         return false;
     }
-    if (vec_parsed_event_ptr->size() != 0) {
+    if (parsed_event_store_ptr->size() != 0) {
         LOG(WARNING) << "Parsed event is not empty, deleting old data";
-        vec_parsed_event_ptr->clear();
+        parsed_event_store_ptr->clear();
     }
 
     auto _last_frame_time = vec_parsed_frame_ptr->at(0).time_ns;
@@ -1157,12 +1439,8 @@ bool SJSV_eventbuilder::reconstruct_event(Double_t _threshold_time_ns){
                     continue;
                 }
 
-                auto _parsed_event = new parsed_event();
-                _parsed_event->frames_ptr = _candidate_frames;
-                _parsed_event->id = _current_event_id;
+                parsed_event_store_ptr->push_event(_candidate_frames, _current_event_id);
                 _current_event_id++;
-
-                vec_parsed_event_ptr->push_back(*_parsed_event);
             }
             _candidate_frames.clear();
         }
@@ -1174,7 +1452,6 @@ bool SJSV_eventbuilder::reconstruct_event(Double_t _threshold_time_ns){
 }
 
 bool SJSV_eventbuilder::reconstruct_event_list(Double_t _threshold_time_ns){
-    int _seed_list_max_len = RECONSTRUCTION_LIST_LEN;
     auto _parsed_frame_num = vec_parsed_frame_ptr->size();
     if (_parsed_frame_num == 0) {
         LOG(ERROR) << "Parsed frame vector is empty";
@@ -1184,11 +1461,114 @@ bool SJSV_eventbuilder::reconstruct_event_list(Double_t _threshold_time_ns){
         LOG(ERROR) << "Threshold time is negative";
         return false;
     }
-    if (vec_parsed_event_ptr->size() != 0) {
+    if (parsed_event_store_ptr->size() != 0) {
         LOG(WARNING) << "Parsed event is not empty, deleting old data";
-        vec_parsed_event_ptr->clear();
+        parsed_event_store_ptr->clear();
+    }
+
+    auto _is_time_sorted = std::is_sorted(vec_parsed_frame_ptr->begin(), vec_parsed_frame_ptr->end(),
+        [](const parsed_frame &_a, const parsed_frame &_b) { return _a.time_ns < _b.time_ns; });
+    if (!_is_time_sorted) {
+        LOG(INFO) << "Parsed frames are not sorted in time, using the seed window rescan";
+        reconstruct_event_list_rescan(_threshold_time_ns);
+        return true;
+    }
+
+    int _truncated_window_cnt = 0;
+    if (reconstruction_thread_num > 1) {
+        _truncated_window_cnt = reconstruct_sorted_segments(_threshold_time_ns);
+    } else {
+        uint32_t _current_event_id = 1;
+        _truncated_window_cnt = cluster_sorted_frames(0, _parsed_frame_num, _threshold_time_ns, *parsed_event_store_ptr, _current_event_id);
+    }
+
+    if (_truncated_window_cnt > 0)
+        LOG(WARNING) << _truncated_window_cnt << " events were cut at " << RECONSTRUCTION_CHK_LEN << " frames";
+    return true;
+}
+
+int SJSV_eventbuilder::cluster_sorted_frames(size_t _begin, size_t _end, Double_t _threshold_time_ns, parsed_event_store &_event_store, uint32_t &_current_event_id){
+    // * on time-sorted frames the seed window is a contiguous index range and all frames
+    // * before it are used, so the window start and end only move forward
+    int _truncated_window_cnt = 0;
+    std::vector<parsed_frame*> _candidate_frames;
+    auto &_frames = *vec_parsed_frame_ptr;
+    size_t _window_begin = _begin;
+    while (_window_begin < _end) {
+        auto _seed_time_ns = _frames[_window_begin].time_ns;
+        size_t _window_limit = std::min<size_t>(_window_begin + RECONSTRUCTION_CHK_LEN, _end);
+        size_t _window_end = _window_begin;
+        while (_window_end < _window_limit && abs(_frames[_window_end].time_ns - _seed_time_ns) < _threshold_time_ns)
+            _window_end++;
+        if (_window_end == _window_limit && _window_limit < _end
+            && abs(_frames[_window_limit].time_ns - _seed_time_ns) < _threshold_time_ns)
+            _truncated_window_cnt++;
+
+        _candidate_frames.clear();
+        for (size_t i = _window_begin; i < _window_end; i++)
+            _candidate_frames.push_back(&_frames[i]);
+        save_candidate_event(_candidate_frames, _event_store, _current_event_id);
+        // * an empty window (zero threshold) still consumes its seed
+        _window_begin = std::max(_window_end, _window_begin + 1);
+    }
+    return _truncated_window_cnt;
+}
+
+int SJSV_eventbuilder::reconstruct_sorted_segments(Double_t _threshold_time_ns){
+    auto &_frames = *vec_parsed_frame_ptr;
+    size_t _frame_num = _frames.size();
+
+    // * no seed window reaches across a gap that fails the window test itself, and the serial
+    // * clustering opens a new seed right after it, so segments cut there cluster independently
+    size_t _segment_num_target = size_t(reconstruction_thread_num) * RECONSTRUCTION_SEGMENT_PER_THREAD;
+    size_t _segment_len_target = std::max<size_t>(1, _frame_num / _segment_num_target);
+    std::vector<size_t> _cuts = {0};
+    for (size_t i = 1; i < _frame_num; i++) {
+        if (i - _cuts.back() >= _segment_len_target && !(abs(_frames[i].time_ns - _frames[i - 1].time_ns) < _threshold_time_ns))
+            _cuts.push_back(i);
+    }
+    _cuts.push_back(_frame_num);
+    size_t _segment_num = _cuts.size() - 1;
+    LOG(INFO) << "Reconstructing " << _segment_num << " segments on " << reconstruction_thread_num << " threads";
+
+    // * segments are taken in turn by the workers, event ids are local to a segment
+    std::vector<parsed_event_store> _segment_events(_segment_num);
+    std::vector<int> _segment_truncated(_segment_num, 0);
+    std::atomic<size_t> _next_segment(0);
+    std::vector<std::thread> _workers;
+    for (int t = 0; t < std::min<int>(reconstruction_thread_num, _segment_num); t++) {
+        _workers.emplace_back([&]() {
+            size_t _segment;
+            while ((_segment = _next_segment.fetch_add(1)) < _segment_num) {
+                uint32_t _segment_event_id = 1;
+                _segment_truncated[_segment] = cluster_sorted_frames(_cuts[_segment], _cuts[_segment + 1], _threshold_time_ns, _segment_events[_segment], _segment_event_id);
+            }
+        });
+    }
+    for (auto &_worker : _workers)
+        _worker.join();
+
+    // * concatenate in time order and number the events as the serial clustering does
+    size_t _event_num = 0;
+    size_t _event_frame_num = 0;
+    for (auto &_events : _segment_events) {
+        _event_num += _events.size();
+        _event_frame_num += _events.frames_ptr.size();
     }
+    parsed_event_store_ptr->reserve(_event_num, _event_frame_num);
+    uint32_t _current_event_id = 1;
+    int _truncated_window_cnt = 0;
+    for (size_t _segment = 0; _segment < _segment_num; _segment++) {
+        parsed_event_store_ptr->append(_segment_events[_segment], _current_event_id);
+        _current_event_id += _segment_events[_segment].size();
+        _segment_events[_segment] = parsed_event_store();
+        _truncated_window_cnt += _segment_truncated[_segment];
+    }
+    return _truncated_window_cnt;
+}
 
+void SJSV_eventbuilder::reconstruct_event_list_rescan(Double_t _threshold_time_ns){
+    auto _parsed_frame_num = vec_parsed_frame_ptr->size();
     auto _too_small_event_cnt = 0;
     uint32_t _current_event_id = 1;
     std::vector<bool> _is_frame_used(_parsed_frame_num, false);
@@ -1213,95 +1593,87 @@ bool SJSV_eventbuilder::reconstruct_event_list(Double_t _threshold_time_ns){
                 _is_frame_used.at(_search_index) = true;
             }
         }
-        // check if the candidate frames are legal
-        if (_candidate_frames.size() < MINIMUM_EVENT_HIT) {
+        if (!save_candidate_event(_candidate_frames, *parsed_event_store_ptr, _current_event_id))
             _too_small_event_cnt++;
-            _candidate_frames.clear();
-            continue;
-        }
+    }
+    if (_too_small_event_cnt > 0)
+        LOG(INFO) << _too_small_event_cnt << " candidate events had less than " << MINIMUM_EVENT_HIT << " hits";
+}
 
-        // check for repeated channel, if repeated, only keep the one with larger adc
-        std::vector<uint16_t> _vec_channel;
-        std::vector<uint16_t> _vec_adc;
-        for (auto _frame_ptr : _candidate_frames) {
-            _vec_channel.push_back(_frame_ptr->uni_channel);
-            _vec_adc.push_back(_frame_ptr->adc);
-        }
-        // sort the adc according to the channel
-        std::vector<uint16_t> _vec_channel_sorted;
-        std::vector<uint16_t> _vec_adc_sorted;
-        std::vector<uint16_t> _vec_index_sorted;
-        std::vector<uint16_t> _vec_index;
-        for (auto _index=0; _index<_vec_channel.size(); _index++) {
-            _vec_index.push_back(_index);
-        }
+bool SJSV_eventbuilder::save_candidate_event(std::vector<parsed_frame*> &_candidate_frames, parsed_event_store &_event_store, uint32_t &_current_event_id){
+    // check if the candidate frames are legal
+    if (_candidate_frames.size() < MINIMUM_EVENT_HIT) {
+        return false;
+    }
 
-        std::sort(_vec_index.begin(), _vec_index.end(), [&_vec_channel](size_t _i1, size_t _i2) {return _vec_channel[_i1] < _vec_channel[_i2];});
-        for (auto _index : _vec_index) {
-            _vec_channel_sorted.push_back(_vec_channel.at(_index));
-            _vec_adc_sorted.push_back(_vec_adc.at(_index));
-            _vec_index_sorted.push_back(_index);
-        }
+    remove_repeated_channels(_candidate_frames);
 
-        // check if the channel is repeated
-        std::vector<uint16_t> _vec_frame_to_delete_index;
-        for (auto _index=0; _index<_vec_channel.size(); _index++) {
-            if (_index == 0) {
-                continue;
+    // check if the event is too small
+    if (_candidate_frames.size() < MINIMUM_EVENT_HIT) {
+        return false;
+    }
+
+    // save the event
+    _event_store.push_event(_candidate_frames, _current_event_id);
+    _current_event_id++;
+    return true;
+}
+
+void SJSV_eventbuilder::remove_repeated_channels(std::vector<parsed_frame*> &_candidate_frames){
+    // check for repeated channel, if repeated, only keep the one with larger adc
+    std::vector<uint16_t> _vec_channel;
+    std::vector<uint16_t> _vec_adc;
+    for (auto _frame_ptr : _candidate_frames) {
+        _vec_channel.push_back(_frame_ptr->uni_channel);
+        _vec_adc.push_back(_frame_ptr->adc);
+    }
+    // sort the adc according to the channel
+    std::vector<uint16_t> _vec_channel_sorted;
+    std::vector<uint16_t> _vec_adc_sorted;
+    std::vector<uint16_t> _vec_index_sorted;
+    std::vector<uint16_t> _vec_index;
+    for (auto _index=0; _index<_vec_channel.size(); _index++) {
+        _vec_index.push_back(_index);
+    }
+
+    std::sort(_vec_index.begin(), _vec_index.end(), [&_vec_channel](size_t _i1, size_t _i2) {return _vec_channel[_i1] < _vec_channel[_i2];});
+    for (auto _index : _vec_index) {
+        _vec_channel_sorted.push_back(_vec_channel.at(_index));
+        _vec_adc_sorted.push_back(_vec_adc.at(_index));
+        _vec_index_sorted.push_back(_index);
+    }
+
+    // check if the channel is repeated
+    std::vector<uint16_t> _vec_frame_to_delete_index;
+    for (auto _index=0; _index<_vec_channel.size(); _index++) {
+        if (_index == 0) {
+            continue;
+        }
+        if (_vec_channel_sorted.at(_index) == _vec_channel_sorted.at(_index-1)) {
+            // if the previous one is already in the list, then delete this one 
+            if (std::find(_vec_frame_to_delete_index.begin(), _vec_frame_to_delete_index.end(), _vec_index_sorted.at(_index-1)) != _vec_frame_to_delete_index.end()) {
+                _vec_frame_to_delete_index.push_back(_vec_index_sorted.at(_index));
             }
-            if (_vec_channel_sorted.at(_index) == _vec_channel_sorted.at(_index-1)) {
-                // if the previous one is already in the list, then delete this one 
-                if (std::find(_vec_frame_to_delete_index.begin(), _vec_frame_to_delete_index.end(), _vec_index_sorted.at(_index-1)) != _vec_frame_to_delete_index.end()) {
+            else {
+                if (_vec_adc_sorted.at(_index) > _vec_adc_sorted.at(_index-1)) {
+                    // keep the one with larger adc
+                    _vec_frame_to_delete_index.push_back(_vec_index_sorted.at(_index-1));
+                } else {
                     _vec_frame_to_delete_index.push_back(_vec_index_sorted.at(_index));
                 }
-                else {
-                    if (_vec_adc_sorted.at(_index) > _vec_adc_sorted.at(_index-1)) {
-                        // keep the one with larger adc
-                        _vec_frame_to_delete_index.push_back(_vec_index_sorted.at(_index-1));
-                    } else {
-                        _vec_frame_to_delete_index.push_back(_vec_index_sorted.at(_index));
-                    }
-                }
-            }
-        }
-
-        std::unordered_set<uint16_t> _set_frame_to_delete_index(_vec_frame_to_delete_index.begin(), _vec_frame_to_delete_index.end());
-        std::vector<uint16_t> _sorted_delete_index(_set_frame_to_delete_index.begin(), _set_frame_to_delete_index.end());
-        std::sort(_sorted_delete_index.begin(), _sorted_delete_index.end(), std::greater<uint16_t>());
-
-        for (uint16_t index: _sorted_delete_index) {
-            if (index >= 0 && index < _candidate_frames.size()) {
-                _candidate_frames.erase(_candidate_frames.begin() + index);
             }
         }
+    }
 
+    std::unordered_set<uint16_t> _set_frame_to_delete_index(_vec_frame_to_delete_index.begin(), _vec_frame_to_delete_index.end());
+    std::vector<uint16_t> _sorted_delete_index(_set_frame_to_delete_index.begin(), _set_frame_to_delete_index.end());
+    std::sort(_sorted_delete_index.begin(), _sorted_delete_index.end(), std::greater<uint16_t>());
 
-        // check if the event is too small
-        if (_candidate_frames.size() < MINIMUM_EVENT_HIT) {
-            _too_small_event_cnt++;
-            _candidate_frames.clear();
-            continue;
+    for (uint16_t index: _sorted_delete_index) {
+        if (index >= 0 && index < _candidate_frames.size()) {
+            _candidate_frames.erase(_candidate_frames.begin() + index);
         }
-
-
-        // save the event
-        auto _parsed_event = new parsed_event();
-        _parsed_event->frames_ptr = _candidate_frames;
-        _parsed_event->id = _current_event_id;
-        _current_event_id++;
-
-        vec_parsed_event_ptr->push_back(*_parsed_event);
-        // if (vec_parsed_event_ptr->size() == 1) {
-        //     LOG(DEBUG) << "Event " << _parsed_event->id << " reconstructed with " << _candidate_frames.size() << " frames";
-        //     for (auto _frame_ptr : vec_parsed_event_ptr->at(0).frames_ptr) {
-        //         LOG(DEBUG) << "Frame " << _frame_ptr->uni_channel << " " << _frame_ptr->adc << " " << _frame_ptr->time_ns;
-        //     }
-        // }
-
-        // print info
     }
-
-    return true;
 }
 
 TH1D* SJSV_eventbuilder::quick_plot_event_chnnum_hist(int max_channel_num){
@@ -1310,8 +1682,8 @@ TH1D* SJSV_eventbuilder::quick_plot_event_chnnum_hist(int max_channel_num){
     _hist->SetTitle(_hist_name);
     _hist->SetBins(max_channel_num, 0, max_channel_num);
 
-    for (auto _event: *vec_parsed_event_ptr) {
-        _hist->Fill(_event.frames_ptr.size());
+    for (size_t i = 0; i < parsed_event_store_ptr->size(); i++) {
+        _hist->Fill(parsed_event_store_ptr->at(i).frames_ptr.size());
     }
     
     _hist->SetStats(true);
@@ -1327,7 +1699,8 @@ TH1D* SJSV_eventbuilder::quick_plot_event_adc_hist(Int_t _bin_num, Double_t _bin
 
     _hist->SetBins(_bin_num, _bin_low, _bin_high);
 
-    for (auto _event: *vec_parsed_event_ptr) {
+    for (size_t i = 0; i < parsed_event_store_ptr->size(); i++) {
+        auto _event = parsed_event_store_ptr->at(i);
         Double_t _adc_sum = 0;
         for (auto _frame_ptr : _event.frames_ptr) {
             if (is_frame_HG(*_frame_ptr))
@@ -1349,7 +1722,8 @@ TH1D* SJSV_eventbuilder::quick_plot_event_LG_adc_hist(Int_t _bin_num, Double_t _
 
     _hist->SetBins(_bin_num, _bin_low, _bin_high);
 
-    for (auto _event: *vec_parsed_event_ptr) {
+    for (size_t i = 0; i < parsed_event_store_ptr->size(); i++) {
+        auto _event = parsed_event_store_ptr->at(i);
         Double_t _adc_sum = 0;
         for (auto _frame_ptr : _event.frames_ptr) {
             if (!is_frame_HG(*_frame_ptr))
@@ -1374,14 +1748,14 @@ TH2D* SJSV_eventbuilder::quick_plot_mapped_events_sum(void){
     _vec_channel.erase(_it, _vec_channel.end());
 
     // create a summed event
-    parsed_event _summed_event;
+    std::vector<parsed_frame*> _summed_frames;
     for (auto _chn: _vec_channel){
         parsed_frame* _parsed_frame = new parsed_frame();
         _parsed_frame->uni_channel = _chn;
         _parsed_frame->adc = 0;
         _parsed_frame->time_ns = 0;
         _parsed_frame->event_id = 0;
-        _summed_event.frames_ptr.push_back(_parsed_frame);
+        _summed_frames.push_back(_parsed_frame);
     }
 
     for (auto _parsed_frame : *vec_parsed_frame_ptr) {
@@ -1389,7 +1763,7 @@ TH2D* SJSV_eventbuilder::quick_plot_mapped_events_sum(void){
         if (_uni_channel > 20000)
             LOG(ERROR) << "Channel number too large in plot: " << _uni_channel;
         auto _adc = _parsed_frame.adc;
-        for (auto _frame_ptr : _summed_event.frames_ptr) {
+        for (auto _frame_ptr : _summed_frames) {
             if (_frame_ptr->uni_channel == _uni_channel) {
                 _frame_ptr->adc += _adc;
             }
@@ -1397,7 +1771,7 @@ TH2D* SJSV_eventbuilder::quick_plot_mapped_events_sum(void){
     }
 
     auto max_adc_sum = 0;
-    for (auto _frame_ptr : _summed_event.frames_ptr) {
+    for (auto _frame_ptr : _summed_frames) {
         if (_frame_ptr->adc > max_adc_sum) {
             max_adc_sum = _frame_ptr->adc;
         }
@@ -1405,6 +1779,8 @@ TH2D* SJSV_eventbuilder::quick_plot_mapped_events_sum(void){
 
     LOG(INFO) << "Max ADC sum: " << max_adc_sum;
 
+    parsed_event _summed_event;
+    _summed_event.frames_ptr = frame_ptr_span(_summed_frames);
     auto _mapped_event = map_event(_summed_event, *mapping_info_ptr);
 
     for (auto _parsed_frame : *vec_parsed_frame_ptr) {
@@ -1418,16 +1794,16 @@ TH2D* SJSV_eventbuilder::quick_plot_mapped_events_sum(void){
 
 TH2D* SJSV_eventbuilder::quick_plot_mapped_events_sum2(void){
     // create a summed event
-    parsed_event _summed_event;
+    std::vector<parsed_frame*> _summed_frames;
 
-    for (auto i=0; i<500; i++){
-        auto _event = vec_parsed_event_ptr->at(i);
+    for (size_t i=0; i<500 && i<parsed_event_store_ptr->size(); i++){
+        auto _event = parsed_event_store_ptr->at(i);
         for (auto _frame_ptr: _event.frames_ptr){
             // see if the summed event has this channel
             bool _has_channel = false;
             int _frame_index = 0;
-            for (auto _frame_cnt=0; _frame_cnt<_summed_event.frames_ptr.size(); _frame_cnt++){
-                if (_summed_event.frames_ptr.at(_frame_cnt)->uni_channel == _frame_ptr->uni_channel){
+            for (auto _frame_cnt=0; _frame_cnt<_summed_frames.size(); _frame_cnt++){
+                if (_summed_frames.at(_frame_cnt)->uni_channel == _frame_ptr->uni_channel){
                     _has_channel = true;
                     _frame_index = _frame_cnt;
                     break;
@@ -1439,9 +1815,9 @@ TH2D* SJSV_eventbuilder::quick_plot_mapped_events_sum2(void){
                 _parsed_frame->adc = _frame_ptr->adc;
                 _parsed_frame->time_ns = _frame_ptr->time_ns;
                 _parsed_frame->event_id = _frame_ptr->event_id;
-                _summed_event.frames_ptr.push_back(_parsed_frame);
+                _summed_frames.push_back(_parsed_frame);
             } else {
-                _summed_event.frames_ptr.at(_frame_index)->adc += _frame_ptr->adc;
+                _summed_frames.at(_frame_index)->adc += _frame_ptr->adc;
             }
         }
     }
@@ -1449,7 +1825,7 @@ TH2D* SJSV_eventbuilder::quick_plot_mapped_events_sum2(void){
     // Fill the rest channels with 1
     for (auto i=0; i < 16*64; i++){
         bool _has_channel = false;
-        for (auto _frame_ptr: _summed_event.frames_ptr){
+        for (auto _frame_ptr: _summed_frames){
             if (_frame_ptr->uni_channel == i){
                 _has_channel = true;
                 break;
@@ -1461,12 +1837,12 @@ TH2D* SJSV_eventbuilder::quick_plot_mapped_events_sum2(void){
             _parsed_frame->adc = 1;
             _parsed_frame->time_ns = 0;
             _parsed_frame->event_id = 0;
-            _summed_event.frames_ptr.push_back(_parsed_frame);
+            _summed_frames.push_back(_parsed_frame);
         }
     }
 
     auto max_adc_sum = 0;
-    for (auto _frame_ptr : _summed_event.frames_ptr) {
+    for (auto _frame_ptr : _summed_frames) {
         if (_frame_ptr->adc > max_adc_sum) {
             max_adc_sum = _frame_ptr->adc;
         }
@@ -1474,6 +1850,8 @@ TH2D* SJSV_eventbuilder::quick_plot_mapped_events_sum2(void){
 
     LOG(INFO) << "Max ADC sum: " << max_adc_sum;
 
+    parsed_event _summed_event;
+    _summed_event.frames_ptr = frame_ptr_span(_summed_frames);
     auto _mapped_event = map_event(_summed_event, *mapping_info_ptr);
 
     for (auto _parsed_frame : *vec_parsed_frame_ptr) {
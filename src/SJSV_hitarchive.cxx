@@ -0,0 +1,399 @@
+#include "SJSV_hitarchive.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <sys/mman.h>
+
+#define HITARCHIVE_TIMESTAMP_MASK   0x00FFFFFFFFFFFFFFULL
+
+const std::array<uint8_t, HITARCHIVE_FIELD_NUM> SJSV_hitarchive::field_shift   = {0, 8, 14, 15, 27, 37, 42, 47};
+const std::array<uint8_t, HITARCHIVE_FIELD_NUM> SJSV_hitarchive::field_bit_num = {8, 6,  1, 12, 10,  5,  5,  4};
+
+static inline void put_varint(std::vector<uint8_t> &_buf, uint64_t _val) {
+    while (_val >= 0x80) {
+        _buf.push_back(uint8_t(_val) | 0x80);
+        _val >>= 7;
+    }
+    _buf.push_back(uint8_t(_val));
+}
+
+// * @return false if the varint runs past _end
+static inline bool get_varint(const uint8_t* &_ptr, const uint8_t* _end, uint64_t &_val) {
+    _val = 0;
+    for (int _shift = 0; _shift < 64 && _ptr < _end; _shift += 7) {
+        uint8_t _byte = *_ptr++;
+        _val |= uint64_t(_byte & 0x7F) << _shift;
+        if (!(_byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static inline uint64_t zigzag_encode(int64_t _val) {
+    return (uint64_t(_val) << 1) ^ uint64_t(_val >> 63);
+}
+
+static inline int64_t zigzag_decode(uint64_t _val) {
+    return int64_t(_val >> 1) ^ -int64_t(_val & 1);
+}
+
+static inline uint8_t bit_width(uint64_t _val) {
+    return _val == 0 ? 0 : 64 - __builtin_clzll(_val);
+}
+
+SJSV_hitarchive::SJSV_hitarchive() {}
+
+SJSV_hitarchive::~SJSV_hitarchive() {
+    if (out_file.is_open())
+        finish();
+    close();
+}
+
+bool SJSV_hitarchive::is_archive_file(const std::string &_filename) {
+    std::ifstream _file(_filename, std::ios::binary);
+    uint64_t _magic = 0;
+    _file.read(reinterpret_cast<char*>(&_magic), sizeof(_magic));
+    return bool(_file) && _magic == HITARCHIVE_MAGIC;
+}
+
+bool SJSV_hitarchive::create(const std::string &_filename) {
+    close();
+    filename = _filename;
+    out_file.open(filename, std::ios::binary | std::ios::trunc);
+    if (!out_file.is_open()) {
+        LOG(ERROR) << "Cannot create hit archive " << filename;
+        return false;
+    }
+    frame_num = 0;
+    block_index_vec.clear();
+    pending_block.clear();
+    pending_block.reserve(HITARCHIVE_BLOCK_HIT_NUM);
+
+    // * rewritten by finish once the index offset is known
+    file_header _header = {HITARCHIVE_MAGIC, 0, 0, 0};
+    out_file.write(reinterpret_cast<const char*>(&_header), sizeof(_header));
+    return bool(out_file);
+}
+
+void SJSV_hitarchive::append(const uni_frame &_frame) {
+    pending_block.push_back(_frame);
+    if (pending_block.hit_word_vec.size() >= HITARCHIVE_BLOCK_HIT_NUM)
+        flush_block();
+}
+
+void SJSV_hitarchive::append(const packed_frame_store &_store) {
+    for (auto _frame : _store)
+        append(_frame);
+}
+
+void SJSV_hitarchive::encode_block(const packed_frame_store &_block, std::vector<uint8_t> &_buf) const {
+    block_header _header;
+    memset(&_header, 0, sizeof(_header));
+    _header.hit_num    = _block.hit_word_vec.size();
+    _header.marker_num = _block.marker_vec.size();
+
+    // * field ranges of the block
+    std::array<uint64_t, HITARCHIVE_FIELD_NUM> _field_max;
+    _field_max.fill(0);
+    for (int j = 0; j < HITARCHIVE_FIELD_NUM; j++)
+        _header.field_min[j] = (1 << field_bit_num[j]) - 1;
+    for (auto _word : _block.hit_word_vec) {
+        for (int j = 0; j < HITARCHIVE_FIELD_NUM; j++) {
+            uint64_t _val = (_word >> field_shift[j]) & ((1ULL << field_bit_num[j]) - 1);
+            _header.field_min[j] = std::min<uint64_t>(_header.field_min[j], _val);
+            _field_max[j] = std::max(_field_max[j], _val);
+        }
+    }
+    uint32_t _hit_bit_num = 0;
+    for (int j = 0; j < HITARCHIVE_FIELD_NUM; j++) {
+        if (_block.hit_word_vec.empty())
+            _header.field_min[j] = 0;
+        _header.field_width[j] = bit_width(_field_max[j] - _header.field_min[j]);
+        _hit_bit_num += _header.field_width[j];
+    }
+
+    _buf.assign(sizeof(block_header), 0);
+
+    // * markers: hit position and timestamp as deltas to the previous marker, FEC id in the low bits
+    uint64_t _last_hit_pos = 0, _last_timestamp = 0;
+    for (auto &_marker : _block.marker_vec) {
+        uint64_t _timestamp = _marker.timestamp & HITARCHIVE_TIMESTAMP_MASK;
+        put_varint(_buf, _marker.hit_pos - _last_hit_pos);
+        put_varint(_buf, (zigzag_encode(int64_t(_timestamp - _last_timestamp)) << 4) | packed_frame_store::marker_fec_id(_marker));
+        _last_hit_pos   = _marker.hit_pos;
+        _last_timestamp = _timestamp;
+    }
+    _header.marker_byte_num = _buf.size() - sizeof(block_header);
+
+    // * hits: the field offsets of a hit are concatenated and written LSB first
+    size_t _hit_begin = _buf.size();
+    uint64_t _acc = 0;
+    uint32_t _fill = 0;
+    auto _put_bits = [&](uint64_t _val, uint32_t _width) {
+        if (_width == 0)
+            return;
+        _acc |= _val << _fill;
+        _fill += _width;
+        if (_fill >= 64) {
+            _buf.insert(_buf.end(), reinterpret_cast<const uint8_t*>(&_acc), reinterpret_cast<const uint8_t*>(&_acc) + sizeof(_acc));
+            _fill -= 64;
+            _acc = _fill > 0 ? _val >> (_width - _fill) : 0;
+        }
+    };
+    for (auto _word : _block.hit_word_vec) {
+        uint64_t _packed = 0;
+        uint32_t _packed_width = 0;
+        for (int j = 0; j < HITARCHIVE_FIELD_NUM; j++) {
+            uint64_t _val = ((_word >> field_shift[j]) & ((1ULL << field_bit_num[j]) - 1)) - _header.field_min[j];
+            _packed |= _val << _packed_width;
+            _packed_width += _header.field_width[j];
+        }
+        _put_bits(_packed, _hit_bit_num);
+    }
+    if (_fill > 0)
+        _buf.insert(_buf.end(), reinterpret_cast<const uint8_t*>(&_acc), reinterpret_cast<const uint8_t*>(&_acc) + (_fill + 7) / 8);
+    // * padding for the 8-byte loads of the decoder
+    _buf.insert(_buf.end(), sizeof(uint64_t), 0);
+    _header.hit_byte_num = _buf.size() - _hit_begin;
+
+    memcpy(_buf.data(), &_header, sizeof(_header));
+}
+
+bool SJSV_hitarchive::flush_block() {
+    if (pending_block.empty())
+        return true;
+    encode_block(pending_block, block_buf);
+
+    block_info _info;
+    _info.offset          = out_file.tellp();
+    _info.byte_num        = block_buf.size();
+    _info.frame_pos       = frame_num;
+    _info.hit_num         = pending_block.hit_word_vec.size();
+    _info.marker_num      = pending_block.marker_vec.size();
+    _info.first_timestamp = pending_block.marker_vec.empty() ? 0 : pending_block.marker_vec.front().timestamp & HITARCHIVE_TIMESTAMP_MASK;
+    block_index_vec.push_back(_info);
+    frame_num += pending_block.size();
+
+    out_file.write(reinterpret_cast<const char*>(block_buf.data()), block_buf.size());
+    pending_block.clear();
+    return bool(out_file);
+}
+
+bool SJSV_hitarchive::finish() {
+    if (!out_file.is_open()) {
+        LOG(ERROR) << "Hit archive is not open for writing";
+        return false;
+    }
+    bool _is_written = flush_block();
+
+    file_header _header = {HITARCHIVE_MAGIC, uint64_t(block_index_vec.size()), frame_num, uint64_t(out_file.tellp())};
+    out_file.write(reinterpret_cast<const char*>(block_index_vec.data()), block_index_vec.size() * sizeof(block_info));
+    uint64_t _file_byte_num = out_file.tellp();
+    out_file.seekp(0);
+    out_file.write(reinterpret_cast<const char*>(&_header), sizeof(_header));
+    _is_written = _is_written && bool(out_file);
+    out_file.close();
+    pending_block.release();
+
+    if (!_is_written) {
+        LOG(ERROR) << "Cannot write hit archive " << filename;
+        return false;
+    }
+    LOG(INFO) << "Wrote " << frame_num << " frames in " << block_index_vec.size() << " blocks to " << filename
+              << " (" << _file_byte_num / 1024 << " kB, " << (frame_num > 0 ? double(_file_byte_num) / frame_num : 0) << " bytes per frame)";
+    return true;
+}
+
+bool SJSV_hitarchive::open(const std::string &_filename) {
+    close();
+    filename = _filename;
+    int _fd = ::open(filename.c_str(), O_RDONLY);
+    if (_fd < 0) {
+        LOG(ERROR) << "Cannot open hit archive " << filename;
+        return false;
+    }
+    struct stat _file_stat;
+    if (fstat(_fd, &_file_stat) != 0 || size_t(_file_stat.st_size) < sizeof(file_header)) {
+        LOG(ERROR) << "Hit archive " << filename << " is too short";
+        ::close(_fd);
+        return false;
+    }
+    mmap_len = _file_stat.st_size;
+    void* _data = mmap(nullptr, mmap_len, PROT_READ, MAP_PRIVATE, _fd, 0);
+    ::close(_fd);
+    if (_data == MAP_FAILED) {
+        LOG(ERROR) << "Cannot map hit archive " << filename;
+        mmap_len = 0;
+        return false;
+    }
+    mmap_data = static_cast<const uint8_t*>(_data);
+
+    file_header _header;
+    memcpy(&_header, mmap_data, sizeof(_header));
+    if (_header.magic != HITARCHIVE_MAGIC) {
+        LOG(ERROR) << filename << " is not a hit archive";
+        close();
+        return false;
+    }
+    if (_header.index_offset < sizeof(file_header) || _header.index_offset > mmap_len
+        || _header.block_num > (mmap_len - _header.index_offset) / sizeof(block_info)) {
+        LOG(ERROR) << "Hit archive " << filename << " is truncated";
+        close();
+        return false;
+    }
+    block_index_vec.resize(_header.block_num);
+    memcpy(block_index_vec.data(), mmap_data + _header.index_offset, _header.block_num * sizeof(block_info));
+    for (auto &_info : block_index_vec) {
+        if (_info.offset < sizeof(file_header) || _info.offset > _header.index_offset || _info.byte_num > _header.index_offset - _info.offset) {
+            LOG(ERROR) << "Block index of hit archive " << filename << " is corrupted";
+            close();
+            return false;
+        }
+    }
+    frame_num = _header.frame_num;
+    LOG(INFO) << "Opened hit archive " << filename << " with " << frame_num << " frames in " << block_index_vec.size() << " blocks";
+    return true;
+}
+
+void SJSV_hitarchive::close() {
+    if (mmap_data != nullptr) {
+        munmap(const_cast<uint8_t*>(mmap_data), mmap_len);
+        mmap_data = nullptr;
+        mmap_len  = 0;
+    }
+    block_index_vec.clear();
+    frame_num = 0;
+}
+
+int64_t SJSV_hitarchive::find_block_by_timestamp(uint64_t _timestamp) const {
+    int64_t _found = -1;
+    for (size_t i = 0; i < block_index_vec.size(); i++) {
+        if (block_index_vec[i].marker_num == 0)
+            continue;
+        if (block_index_vec[i].first_timestamp > _timestamp)
+            break;
+        _found = i;
+    }
+    return _found;
+}
+
+bool SJSV_hitarchive::decode_block(size_t _block_index, packed_frame_store &_store) const {
+    if (mmap_data == nullptr || _block_index >= block_index_vec.size()) {
+        LOG(ERROR) << "Block " << _block_index << " is not available";
+        return false;
+    }
+    auto &_info = block_index_vec[_block_index];
+    const uint8_t* _block = mmap_data + _info.offset;
+    block_header _header;
+    if (_info.byte_num < sizeof(_header)) {
+        LOG(ERROR) << "Block " << _block_index << " of " << filename << " is corrupted";
+        return false;
+    }
+    memcpy(&_header, _block, sizeof(_header));
+
+    uint32_t _hit_bit_num = 0;
+    bool _is_valid = _header.hit_num == _info.hit_num && _header.marker_num == _info.marker_num
+        && uint64_t(sizeof(_header)) + _header.marker_byte_num + _header.hit_byte_num <= _info.byte_num;
+    for (int j = 0; j < HITARCHIVE_FIELD_NUM; j++) {
+        _is_valid = _is_valid && _header.field_width[j] <= field_bit_num[j];
+        _hit_bit_num += _header.field_width[j];
+    }
+    _is_valid = _is_valid && (uint64_t(_hit_bit_num) * _header.hit_num + 7) / 8 + sizeof(uint64_t) <= _header.hit_byte_num;
+    if (!_is_valid) {
+        LOG(ERROR) << "Block " << _block_index << " of " << filename << " is corrupted";
+        return false;
+    }
+
+    uint64_t _hit_base = _store.hit_word_vec.size();
+    const uint8_t* _ptr = _block + sizeof(_header);
+    const uint8_t* _marker_end = _ptr + _header.marker_byte_num;
+    _store.marker_vec.reserve(_store.marker_vec.size() + _header.marker_num);
+    uint64_t _hit_pos = 0, _timestamp = 0;
+    for (uint32_t i = 0; i < _header.marker_num; i++) {
+        uint64_t _hit_delta, _time_field;
+        if (!get_varint(_ptr, _marker_end, _hit_delta) || !get_varint(_ptr, _marker_end, _time_field)) {
+            LOG(ERROR) << "Markers of block " << _block_index << " of " << filename << " are corrupted";
+            return false;
+        }
+        _hit_pos  += _hit_delta;
+        _timestamp = (_timestamp + zigzag_decode(_time_field >> 4)) & HITARCHIVE_TIMESTAMP_MASK;
+        _store.marker_vec.push_back({_hit_base + std::min<uint64_t>(_hit_pos, _header.hit_num), _timestamp | ((_time_field & 0xF) << 56)});
+    }
+
+    // * one unaligned 8-byte load per hit, the block is padded for the last one
+    const uint8_t* _hit_data = _marker_end;
+    uint64_t _hit_mask = _hit_bit_num == 0 ? 0 : (~0ULL >> (64 - _hit_bit_num));
+    uint64_t _word_base = 0;
+    for (int j = 0; j < HITARCHIVE_FIELD_NUM; j++)
+        _word_base |= uint64_t(_header.field_min[j]) << field_shift[j];
+    _store.hit_word_vec.resize(_hit_base + _header.hit_num);
+    uint64_t* _out = _store.hit_word_vec.data() + _hit_base;
+    uint64_t _bit_pos = 0;
+    for (uint32_t i = 0; i < _header.hit_num; i++, _bit_pos += _hit_bit_num) {
+        uint64_t _raw;
+        memcpy(&_raw, _hit_data + (_bit_pos >> 3), sizeof(_raw));
+        uint64_t _packed = (_raw >> (_bit_pos & 7)) & _hit_mask;
+        uint64_t _word = _word_base;
+        for (int j = 0; j < HITARCHIVE_FIELD_NUM; j++) {
+            _word += (_packed & ((1ULL << _header.field_width[j]) - 1)) << field_shift[j];
+            _packed >>= _header.field_width[j];
+        }
+        _out[i] = _word;
+    }
+    return true;
+}
+
+bool SJSV_hitarchive::for_each_block(const block_callback &_callback) const {
+    packed_frame_store _block;
+    _block.reserve(HITARCHIVE_BLOCK_HIT_NUM);
+    for (size_t i = 0; i < block_index_vec.size(); i++) {
+        _block.clear();
+        if (!decode_block(i, _block))
+            return false;
+        if (!_callback(_block, i))
+            break;
+    }
+    return true;
+}
+
+bool SJSV_hitarchive::load_frames(packed_frame_store &_store, int _thread_num) const {
+    if (mmap_data == nullptr) {
+        LOG(ERROR) << "Hit archive is not open";
+        return false;
+    }
+    if (_thread_num <= 0)
+        _thread_num = std::max(1u, std::thread::hardware_concurrency());
+    size_t _range_num = std::max<size_t>(1, std::min<size_t>(_thread_num, block_index_vec.size()));
+
+    // * each thread decodes a contiguous range of blocks, ranges are concatenated in order
+    std::vector<packed_frame_store> _range_stores(_range_num);
+    std::atomic<bool> _is_failed(false);
+    std::vector<std::thread> _workers;
+    for (size_t r = 0; r < _range_num; r++) {
+        _workers.emplace_back([this, r, _range_num, &_range_stores, &_is_failed]() {
+            size_t _begin = block_index_vec.size() * r / _range_num;
+            size_t _end   = block_index_vec.size() * (r + 1) / _range_num;
+            uint64_t _hit_num = 0;
+            for (size_t i = _begin; i < _end; i++)
+                _hit_num += block_index_vec[i].hit_num;
+            _range_stores[r].reserve(_hit_num);
+            for (size_t i = _begin; i < _end && !_is_failed; i++) {
+                if (!decode_block(i, _range_stores[r]))
+                    _is_failed = true;
+            }
+        });
+    }
+    for (auto &_worker : _workers)
+        _worker.join();
+    if (_is_failed)
+        return false;
+
+    uint64_t _hit_num = _store.hit_word_vec.size();
+    for (auto &_range_store : _range_stores)
+        _hit_num += _range_store.hit_word_vec.size();
+    _store.reserve(_hit_num);
+    for (auto &_range_store : _range_stores)
+        _store.append(_range_store);
+    return true;
+}
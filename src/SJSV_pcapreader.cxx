@@ -1,39 +1,229 @@
 #include "SJSV_pcapreader.h"
+#include "SJSV_hitarchive.h"
+
+#ifdef SJSV_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef SJSV_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SJSV_X86_KERNELS
+#endif
+
+// * Frame word kernels
+// * Each kernel turns up to FRAME_BATCH_SIZE raw 6-byte frames into 48-bit
+// * big-endian words and a bit mask of DAQ frames (bit 15 of the frame).
+// * _avail_len is the number of readable bytes from _data, wide loads must stay inside it.
+typedef void (*frame_word_kernel)(const uint8_t* _data, uint32_t _avail_len, uint32_t _frame_num, uint64_t* _words, uint64_t &_daq_mask);
+
+static inline uint64_t load_frame_word(const uint8_t* _frame) {
+    return (uint64_t(_frame[0]) << 40) + (uint64_t(_frame[1]) << 32) + (uint64_t(_frame[2]) << 24) +
+           (uint64_t(_frame[3]) << 16) + (uint64_t(_frame[4]) << 8)  +  uint64_t(_frame[5]);
+}
+
+static void frame_words_scalar(const uint8_t* _data, uint32_t _avail_len, uint32_t _frame_num, uint64_t* _words, uint64_t &_daq_mask) {
+    _daq_mask = 0;
+    for (uint32_t i = 0; i < _frame_num; i++) {
+        _words[i] = load_frame_word(_data + i * LEN_RAW_FRAME_BYTE);
+        _daq_mask |= ((_words[i] >> 15) & 0x1) << i;
+    }
+}
+
+#ifdef SJSV_X86_KERNELS
+// * byte order of two frames in a 16-byte lane, reversed into two little-endian 64-bit words
+#define FRAME_PAIR_SHUFFLE 5, 4, 3, 2, 1, 0, -1, -1, 11, 10, 9, 8, 7, 6, -1, -1
+
+__attribute__((target("sse4.1")))
+static void frame_words_sse41(const uint8_t* _data, uint32_t _avail_len, uint32_t _frame_num, uint64_t* _words, uint64_t &_daq_mask) {
+    const __m128i _shuffle = _mm_setr_epi8(FRAME_PAIR_SHUFFLE);
+    _daq_mask = 0;
+    uint32_t i = 0;
+    // * two frames per 16-byte load
+    for (; i + 2 <= _frame_num && i * LEN_RAW_FRAME_BYTE + 16 <= _avail_len; i += 2) {
+        auto _raw   = _mm_loadu_si128(reinterpret_cast<const __m128i*>(_data + i * LEN_RAW_FRAME_BYTE));
+        auto _pair  = _mm_shuffle_epi8(_raw, _shuffle);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(_words + i), _pair);
+        auto _flags = _mm_slli_epi64(_pair, 48);
+        _daq_mask |= uint64_t(_mm_movemask_pd(_mm_castsi128_pd(_flags))) << i;
+    }
+    for (; i < _frame_num; i++) {
+        _words[i] = load_frame_word(_data + i * LEN_RAW_FRAME_BYTE);
+        _daq_mask |= ((_words[i] >> 15) & 0x1) << i;
+    }
+}
+
+__attribute__((target("avx2")))
+static void frame_words_avx2(const uint8_t* _data, uint32_t _avail_len, uint32_t _frame_num, uint64_t* _words, uint64_t &_daq_mask) {
+    const __m256i _shuffle = _mm256_setr_epi8(FRAME_PAIR_SHUFFLE, FRAME_PAIR_SHUFFLE);
+    _daq_mask = 0;
+    uint32_t i = 0;
+    // * four frames per iteration, frames 0-1 in the low lane and 2-3 in the high lane
+    for (; i + 4 <= _frame_num && i * LEN_RAW_FRAME_BYTE + 28 <= _avail_len; i += 4) {
+        auto _ptr   = _data + i * LEN_RAW_FRAME_BYTE;
+        auto _low   = _mm_loadu_si128(reinterpret_cast<const __m128i*>(_ptr));
+        auto _high  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(_ptr + 2 * LEN_RAW_FRAME_BYTE));
+        auto _raw   = _mm256_inserti128_si256(_mm256_castsi128_si256(_low), _high, 1);
+        auto _quad  = _mm256_shuffle_epi8(_raw, _shuffle);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(_words + i), _quad);
+        auto _flags = _mm256_slli_epi64(_quad, 48);
+        _daq_mask |= uint64_t(_mm256_movemask_pd(_mm256_castsi256_pd(_flags))) << i;
+    }
+    for (; i < _frame_num; i++) {
+        _words[i] = load_frame_word(_data + i * LEN_RAW_FRAME_BYTE);
+        _daq_mask |= ((_words[i] >> 15) & 0x1) << i;
+    }
+}
+#endif
+
+static frame_word_kernel select_frame_word_kernel(std::string &_name) {
+#ifdef SJSV_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        _name = "avx2";
+        return frame_words_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        _name = "sse4.1";
+        return frame_words_sse41;
+    }
+#endif
+    _name = "scalar";
+    return frame_words_scalar;
+}
+
+static frame_word_kernel get_frame_word_kernel(std::string* _name_ptr = nullptr) {
+    static std::string _name;
+    static const frame_word_kernel _kernel = select_frame_word_kernel(_name);
+    if (_name_ptr != nullptr)
+        *_name_ptr = _name;
+    return _kernel;
+}
+
+// * 12-bit Gray code to binary lookup table for BCID
+struct gray_table {
+    uint16_t value[4096];
+    gray_table() {
+        for (uint32_t _num = 0; _num < 4096; _num++) {
+            uint32_t _bin = _num;
+            _bin = _bin ^ (_bin >> 16);
+            _bin = _bin ^ (_bin >> 8);
+            _bin = _bin ^ (_bin >> 4);
+            _bin = _bin ^ (_bin >> 2);
+            _bin = _bin ^ (_bin >> 1);
+            value[_num] = _bin;
+        }
+    }
+};
+
+static const uint16_t* get_gray_table() {
+    static const gray_table _table;
+    return _table.value;
+}
+
+// * Frame decode kernels
+// * The field positions are compile-time constants of the format, so every kernel is a
+// * straight sequence of shifts and masks without per-frame format checks.
+template <const frame_format &_format>
+static void decode_frame_words(const uint64_t* _words, uint64_t _daq_mask, uint32_t _frame_num, SJSV_pcapreader::uni_frame* _out, uint8_t _fec_id) {
+    constexpr uint8_t _frame_bit_num = LEN_RAW_FRAME_BYTE * 8;
+    static_assert(_format.flag_daq.fits(_frame_bit_num) && _format.timestamp_high.fits(_frame_bit_num) && _format.timestamp_low.fits(_frame_bit_num),
+                  "Frame field outside of the frame");
+    static_assert(_format.offset.width <= 8 && _format.vmm_id.width <= 8 && _format.channel.width <= 8 && _format.tdc.width <= 8 &&
+                  _format.adc.width <= 16 && _format.bcid.width <= 16 && _format.daqdata38.width == 1,
+                  "Frame field wider than its uni_frame member");
+    static_assert(!_format.bcid_gray || _format.bcid.width <= 12, "Gray coded BCID wider than the lookup table");
+    // * the word kernels already flag DAQ frames by bit 15
+    constexpr bool _use_daq_mask = _format.flag_daq.shift == 15 && _format.flag_daq.width == 1;
+    static const uint16_t* _gray_table = get_gray_table();
+
+    for (uint32_t i = 0; i < _frame_num; i++) {
+        auto _word = _words[i];
+        auto &_frame = _out[i];
+        _frame.fec_id = _fec_id;
+        bool _is_daq;
+        if constexpr (_use_daq_mask)
+            _is_daq = (_daq_mask >> i) & 0x1;
+        else
+            _is_daq = _format.flag_daq.extract(_word) != 0;
+        if (_is_daq) {
+            _frame.flag_daq  = true;
+            _frame.offset    = _format.offset.extract(_word);
+            _frame.vmm_id    = _format.vmm_id.extract(_word);
+            _frame.adc       = _format.adc.extract(_word);
+            if constexpr (_format.bcid_gray)
+                _frame.bcid  = _gray_table[_format.bcid.extract(_word)];
+            else
+                _frame.bcid  = _format.bcid.extract(_word);
+            _frame.daqdata38 = _format.daqdata38.extract(_word);
+            _frame.channel   = _format.channel.extract(_word);
+            _frame.tdc       = _format.tdc.extract(_word);
+            _frame.timestamp = 0;
+        } else {
+            _frame.flag_daq  = false;
+            _frame.offset    = 0;
+            _frame.vmm_id    = 0;
+            _frame.adc       = 0;
+            _frame.bcid      = 0;
+            _frame.daqdata38 = 0;
+            _frame.channel   = 0;
+            _frame.tdc       = 0;
+            _frame.timestamp = (_format.timestamp_high.extract(_word) << _format.timestamp_low.width) + _format.timestamp_low.extract(_word);
+        }
+    }
+}
+
+struct frame_format_entry {
+    const frame_format* format;
+    void (*kernel)(const uint64_t*, uint64_t, uint32_t, SJSV_pcapreader::uni_frame*, uint8_t);
+};
+
+// * Supported firmware frame formats, the first entry is the default
+static const frame_format_entry frame_format_table[] = {
+    {&FRAME_FORMAT_VMM3A_SRS, decode_frame_words<FRAME_FORMAT_VMM3A_SRS>},
+};
 
 SJSV_pcapreader::SJSV_pcapreader():
     filename(""),
+    reader(nullptr),
     is_reader_valid(false),
     is_uniframe_vec_valid(false) {
         this->uni_frame_vec = new std::vector<uni_frame>;
+        this->frame_decoder = frame_format_table[0].kernel;
 }
 
 SJSV_pcapreader::SJSV_pcapreader(std::string _filename_str):
     filename(_filename_str),
+    reader(nullptr),
     is_reader_valid(false),
     is_uniframe_vec_valid(false) {
+    this->uni_frame_vec = new std::vector<uni_frame>;
+    this->frame_decoder = frame_format_table[0].kernel;
     if (filename.empty()) {
         LOG(ERROR) << "Filename is empty";
         return;
     }
-    this->uni_frame_vec = new std::vector<uni_frame>;
 }
 
 SJSV_pcapreader::~SJSV_pcapreader() {
-    if (!reader->open())
+    if (reader != nullptr) {
         reader->close();
-    if (reader != NULL)
         delete reader;
+    }
 
     if (uni_frame_vec != nullptr)
         delete uni_frame_vec;
-}
 
-bool SJSV_pcapreader::read_pcapfile() {
-    is_reader_valid = false;
+    unmap_pcapfile();
+}
 
-    if (filename.empty()) {
-        LOG(ERROR) << "Filename is empty";
-        return false;
+bool SJSV_pcapreader::open_reader() {
+    if (reader != nullptr) {
+        reader->close();
+        delete reader;
+        reader = nullptr;
     }
 
     reader = pcpp::IFileReaderDevice::getReader(filename);
@@ -46,66 +236,159 @@ bool SJSV_pcapreader::read_pcapfile() {
         LOG(ERROR) << "Cannot open file " << filename;
         return false;
     }
+    return true;
+}
 
-    auto _packet_num        = 0;
-    auto _eth_packet_num    = 0;
-    auto _ip_packet_num     = 0;
-    auto _udp_packet_num    = 0;
-    auto _daq_packet_num    = 0;
-    // Read the packets from the file
-    pcpp::RawPacket rawPacket;
-    while(reader->getNextPacket(rawPacket)) {
-        _packet_num++;
-        pcpp::Packet parsedPacket(&rawPacket);
+pcpp::UdpLayer* SJSV_pcapreader::count_packet_layers(const pcpp::Packet &_parsedPacket, pcap_statistics &_stats) {
+    _stats.packet_num++;
 
-        pcpp::EthLayer* ethernetLayer = parsedPacket.getLayerOfType<pcpp::EthLayer>();
-        if (ethernetLayer == NULL) {
-            LOG(WARNING) << "Cannot find ethernet layer for packet #" << _packet_num;
-        } else {
-            _eth_packet_num++;
-        }
+    pcpp::EthLayer* ethernetLayer = _parsedPacket.getLayerOfType<pcpp::EthLayer>();
+    if (ethernetLayer == NULL) {
+        LOG(WARNING) << "Cannot find ethernet layer for packet #" << _stats.packet_num;
+    } else {
+        _stats.eth_packet_num++;
+    }
 
-        pcpp::IPv4Layer* ipLayer = parsedPacket.getLayerOfType<pcpp::IPv4Layer>();
-        if (ipLayer == NULL) {
-            LOG(WARNING) << "Cannot find IPv4 layer for packet #" << _packet_num;
-        } else {
-            _ip_packet_num++;
-        }
+    pcpp::IPv4Layer* ipLayer = _parsedPacket.getLayerOfType<pcpp::IPv4Layer>();
+    if (ipLayer == NULL) {
+        LOG(WARNING) << "Cannot find IPv4 layer for packet #" << _stats.packet_num;
+    } else {
+        _stats.ip_packet_num++;
+    }
 
-        pcpp::UdpLayer* udpLayer = parsedPacket.getLayerOfType<pcpp::UdpLayer>();
-        if (udpLayer == NULL) {
-            LOG(WARNING) << "Cannot find UDP layer for packet #" << _packet_num;
-        } else {
-            _udp_packet_num++;
-            if (udpLayer->getSrcPort() == DAQ_DATA_SRC_PORT) {
-                _daq_packet_num++;
-            }
+    pcpp::UdpLayer* udpLayer = _parsedPacket.getLayerOfType<pcpp::UdpLayer>();
+    if (udpLayer == NULL) {
+        LOG(WARNING) << "Cannot find UDP layer for packet #" << _stats.packet_num;
+    } else {
+        _stats.udp_packet_num++;
+        if (udpLayer->getSrcPort() == DAQ_DATA_SRC_PORT) {
+            _stats.daq_packet_num++;
         }
+    }
+    return udpLayer;
+}
+
+void SJSV_pcapreader::log_pcap_statistics() {
+    LOG(INFO) << "Found " << pcap_stats.packet_num << " packets";
+    LOG(INFO) << "Found " << pcap_stats.eth_packet_num << " ethernet packets";
+    LOG(INFO) << "Found " << pcap_stats.ip_packet_num << " IPv4 packets";
+    LOG(INFO) << "Found " << pcap_stats.udp_packet_num << " UDP packets";
+    LOG(INFO) << "Found " << pcap_stats.daq_packet_num << " DAQ packets";
+}
+
+void SJSV_pcapreader::log_link_statistics() const {
+    log_link_statistics(link_stats);
+}
+
+void SJSV_pcapreader::log_link_statistics(const link_statistics &_stats) {
+    if (_stats.packet_num == 0)
+        return;
+    auto _duration_s = _stats.get_duration_s();
+    LOG(INFO) << "Link: " << double(_stats.frame_num) / _stats.packet_num << " frames/packet";
+    if (_duration_s > 0)
+        LOG(INFO) << "Link: " << uint64_t(_stats.packet_num / _duration_s) << " packets/s, "
+                  << _stats.byte_num / _duration_s / 1e6 << " MB/s over " << _duration_s << " s";
+    if (_stats.lost_packet_num > 0 || _stats.out_of_order_num > 0)
+        LOG(WARNING) << "Link: " << _stats.lost_packet_num << " packets lost, " << _stats.out_of_order_num << " out of order";
+    if (_stats.bad_header_num > 0)
+        LOG(WARNING) << "Link: " << _stats.bad_header_num << " packets without a VMM3 data header";
+    for (size_t i = 0; i < _stats.fec_stats.size(); i++) {
+        auto &_fec = _stats.fec_stats[i];
+        if (_fec.packet_num == 0)
+            continue;
+        LOG(INFO) << "FEC " << i << ": " << _fec.packet_num << " packets, " << _fec.frame_num << " frames"
+                  << (_duration_s > 0 ? ", " + std::to_string(_fec.byte_num / _duration_s / 1e6) + " MB/s" : std::string())
+                  << ", " << _fec.lost_packet_num << " lost, " << _fec.out_of_order_num << " out of order";
+    }
+}
 
+void SJSV_pcapreader::link_statistics::merge(const link_statistics &_next) {
+    if (_next.packet_num == 0)
+        return;
+    if (packet_num == 0 || _next.first_time_ns < first_time_ns)
+        first_time_ns = _next.first_time_ns;
+    last_time_ns      = std::max(last_time_ns, _next.last_time_ns);
+    packet_num       += _next.packet_num;
+    frame_num        += _next.frame_num;
+    byte_num         += _next.byte_num;
+    lost_packet_num  += _next.lost_packet_num;
+    out_of_order_num += _next.out_of_order_num;
+    bad_header_num   += _next.bad_header_num;
+    for (size_t i = 0; i < fec_stats.size(); i++) {
+        auto &_fec = fec_stats[i];
+        auto &_next_fec = _next.fec_stats[i];
+        if (!_next_fec.is_counter_valid)
+            continue;
+        // * the step between the two parts is judged like any other pair of packets
+        auto _first_counter = _fec.is_counter_valid ? _fec.first_counter : _next_fec.first_counter;
+        advance_counter(_fec, _next_fec.first_counter);
+        _fec.packet_num       += _next_fec.packet_num;
+        _fec.frame_num        += _next_fec.frame_num;
+        _fec.byte_num         += _next_fec.byte_num;
+        _fec.lost_packet_num  += _next_fec.lost_packet_num;
+        _fec.out_of_order_num += _next_fec.out_of_order_num;
+        _fec.first_counter     = _first_counter;
+        _fec.last_counter      = _next_fec.last_counter;
     }
+}
 
-    reader->close();
+void SJSV_pcapreader::dump_link_window(const link_statistics &_stats, link_statistics &_window_start, uint64_t &_next_dump_ns) const {
+    if (_next_dump_ns == 0) {
+        _next_dump_ns = _stats.first_time_ns + link_stats_dump_interval_ns;
+        return;
+    }
+    if (_stats.last_time_ns < _next_dump_ns)
+        return;
+    auto _start_ns = _window_start.packet_num > 0 ? _window_start.last_time_ns : _stats.first_time_ns;
+    double _window_s = std::max(1e-9, (_stats.last_time_ns - _start_ns) * 1e-9);
+    auto _packet_num = _stats.packet_num - _window_start.packet_num;
+    LOG(INFO) << "Link: " << uint64_t(_packet_num / _window_s) << " packets/s, "
+              << (_stats.byte_num - _window_start.byte_num) / _window_s / 1e6 << " MB/s, "
+              << (_packet_num > 0 ? double(_stats.frame_num - _window_start.frame_num) / _packet_num : 0.) << " frames/packet, "
+              << _stats.lost_packet_num - _window_start.lost_packet_num << " lost, "
+              << _stats.out_of_order_num - _window_start.out_of_order_num << " out of order";
+    _window_start = _stats;
+    _next_dump_ns = _stats.last_time_ns + link_stats_dump_interval_ns;
+}
 
-    reader = pcpp::IFileReaderDevice::getReader(filename);
+bool SJSV_pcapreader::read_pcapfile(bool _prescan) {
+    is_reader_valid = false;
 
-    if (reader == NULL) {
-        LOG(ERROR) << "Cannot read file " << filename;
+    if (filename.empty()) {
+        LOG(ERROR) << "Filename is empty";
         return false;
     }
-    if (!reader->open()) {
-        LOG(ERROR) << "Cannot open file " << filename;
+
+    if (!open_reader())
         return false;
+
+    if (!_prescan) {
+        is_reader_valid = true;
+        return true;
+    }
+
+    pcap_stats = pcap_statistics();
+    // Read the packets from the file
+    pcpp::RawPacket rawPacket;
+    while(reader->getNextPacket(rawPacket)) {
+        pcpp::Packet parsedPacket(&rawPacket);
+        count_packet_layers(parsedPacket, pcap_stats);
     }
 
-    LOG(INFO) << "Found " << _packet_num << " packets";
-    LOG(INFO) << "Found " << _eth_packet_num << " ethernet packets";
+    if (!open_reader())
+        return false;
+
     is_reader_valid = true;
-    LOG(INFO) << "Found " << _ip_packet_num << " IPv4 packets";
-    LOG(INFO) << "Found " << _udp_packet_num << " UDP packets";
-    LOG(INFO) << "Found " << _daq_packet_num << " DAQ packets";
+    log_pcap_statistics();
     return true;
 }
 
+int64_t SJSV_pcapreader::single_pass_decode_pcapfile() {
+    if (!read_pcapfile(false))
+        return -1;
+    return full_decode_pcapfile();
+}
+
 std::string SJSV_pcapreader::protocol2str(pcpp::ProtocolType _protocolType) {
     switch (_protocolType) {
         case pcpp::Ethernet:
@@ -162,46 +445,35 @@ int SJSV_pcapreader::test_decode_first_packet(){
         _packet_num++;
     }
 
-    reader->close();
-
-    reader = pcpp::IFileReaderDevice::getReader(filename);
-
-    if (reader == NULL) {
-        LOG(ERROR) << "Cannot read file " << filename;
-        return false;
-    }
-    if (!reader->open()) {
-        LOG(ERROR) << "Cannot open file " << filename;
-        return false;
-    }
+    if (!open_reader())
+        return -1;
 
     return _packet_num;
 }
 
 std::vector<SJSV_pcapreader::uni_frame> SJSV_pcapreader::decode_pcap_packet(const pcpp::Packet &_parsedPacket) {
     std::vector<SJSV_pcapreader::uni_frame> _frame_array;
+    decode_pcap_packet(_parsedPacket, _frame_array);
+    return _frame_array;
+}
 
+uint32_t SJSV_pcapreader::decode_pcap_packet(const pcpp::Packet &_parsedPacket, std::vector<uni_frame> &_frame_vec) {
     auto _udpLayer = _parsedPacket.getLayerOfType<pcpp::UdpLayer>();
     if (_udpLayer == NULL) {
         LOG(ERROR) << "Cannot find UDP layer for packet";
-        return _frame_array;
+        return 0;
     }
 
     auto _payload = _udpLayer->getLayerPayload();
     if (_payload == NULL) {
         LOG(ERROR) << "Cannot find payload for packet";
-        return _frame_array;
+        return 0;
     }
 
     auto _payload_len = _udpLayer->getLayerPayloadSize();
     // LOG(DEBUG) << "Payload length: " << _payload_len;
 
-    for (int i = LEN_RAW_HEADER_BYTE; i < _payload_len; i += LEN_RAW_FRAME_BYTE) {
-        auto _frame = decode_single_frame(_payload[i], _payload[i + 1], _payload[i + 2], _payload[i + 3], _payload[i + 4], _payload[i + 5]);
-        _frame_array.push_back(_frame);
-    }
-
-    return _frame_array;
+    return decode_pcap_packet(_payload, _payload_len, _frame_vec);
 }
 
 uint32_t SJSV_pcapreader::Gray2bin32(uint32_t _num) {
@@ -224,22 +496,45 @@ int64_t SJSV_pcapreader::full_decode_pcapfile(){
     int64_t _daq_frame_num = 0;
     int64_t _time_frame_num = 0;
 
+    // * in packed mode frames are decoded into a per-packet scratch vector
+    std::vector<uni_frame> _scratch_vec;
+    auto _frame_vec = packed_storage_enabled ? &_scratch_vec : uni_frame_vec;
+
+    struct stat _file_stat;
+    if (stat(filename.c_str(), &_file_stat) == 0) {
+        auto _frame_num = estimate_frame_num(_file_stat.st_size, pcap_stats.packet_num);
+        if (packed_storage_enabled)
+            packed_frames.reserve(packed_frames.hit_word_vec.size() + _frame_num);
+        else
+            uni_frame_vec->reserve(uni_frame_vec->size() + _frame_num);
+    }
+
+    // * statistics are gathered in the same pass, no separate counting read is needed
+    pcap_stats = pcap_statistics();
+    link_stats = link_statistics();
+
     pcpp::RawPacket rawPacket;
     while(reader->getNextPacket(rawPacket)) {
         pcpp::Packet parsedPacket(&rawPacket);
-        pcpp::UdpLayer* udpLayer = parsedPacket.getLayerOfType<pcpp::UdpLayer>();
+        pcpp::UdpLayer* udpLayer = count_packet_layers(parsedPacket, pcap_stats);
         if (udpLayer != NULL) {
             if (udpLayer->getSrcPort() == DAQ_DATA_SRC_PORT) {
-                auto _frame_array = this->decode_pcap_packet(parsedPacket);
-                for (auto _frame : _frame_array) {
-                    this->uni_frame_vec->push_back(_frame);
-                    _length_vec++;
-                    if (_frame.flag_daq) {
+                auto _timestamp = rawPacket.getPacketTimeStamp();
+                link_stats.add_packet(udpLayer->getLayerPayload(), udpLayer->getLayerPayloadSize(),
+                    uint64_t(_timestamp.tv_sec) * 1000000000ULL + _timestamp.tv_nsec);
+                auto _frame_begin = _frame_vec->size();
+                _length_vec += this->decode_pcap_packet(parsedPacket, *_frame_vec);
+                for (auto i = _frame_begin; i < _frame_vec->size(); i++) {
+                    if ((*_frame_vec)[i].flag_daq) {
                         _daq_frame_num++;
                     } else {
                         _time_frame_num++;
                     }
                 }
+                if (packed_storage_enabled) {
+                    packed_frames.append(_scratch_vec.data(), _scratch_vec.size());
+                    _scratch_vec.clear();
+                }
             }
         }
     }
@@ -249,6 +544,8 @@ int64_t SJSV_pcapreader::full_decode_pcapfile(){
         return -1;
     }
 
+    log_pcap_statistics();
+    log_link_statistics();
     LOG(INFO) << "DAQ frame number:  " << _daq_frame_num;
     LOG(INFO) << "Time frame number: " << _time_frame_num;
 
@@ -256,108 +553,1525 @@ int64_t SJSV_pcapreader::full_decode_pcapfile(){
     return _length_vec;
 }
 
-bool SJSV_pcapreader::save_to_rootfile(const std::string &_rootfilename) {
-    if (!is_uniframe_vec_valid) {
-        LOG(ERROR) << "Uniframe vector is not valid";
-        return false;
+uint32_t SJSV_pcapreader::decode_pcap_packet(const uint8_t* _payload, uint32_t _payload_len, std::vector<uni_frame> &_frame_vec) {
+    if (_payload == nullptr) {
+        LOG(ERROR) << "Cannot find payload for packet";
+        return 0;
     }
-    if (_rootfilename.empty()) {
-        LOG(ERROR) << "Root filename is empty";
+
+    if (_payload_len <= LEN_RAW_HEADER_BYTE)
+        return 0;
+    return decode_frame_batch(_payload + LEN_RAW_HEADER_BYTE, _payload_len - LEN_RAW_HEADER_BYTE, _frame_vec, get_payload_fec_id(_payload, _payload_len));
+}
+
+uint32_t SJSV_pcapreader::decode_pcap_packet(const uint8_t* _payload, uint32_t _payload_len, uni_frame* _frame_buf, uint32_t _frame_capacity) {
+    if (_payload == nullptr || _frame_buf == nullptr) {
+        LOG(ERROR) << "Payload or frame buffer is null";
+        return 0;
+    }
+
+    if (_payload_len <= LEN_RAW_HEADER_BYTE)
+        return 0;
+    uint32_t _data_len = _payload_len - LEN_RAW_HEADER_BYTE;
+    if (_data_len / LEN_RAW_FRAME_BYTE > _frame_capacity) {
+        LOG(WARNING) << "Frame buffer too small, " << _data_len / LEN_RAW_FRAME_BYTE - _frame_capacity << " frames dropped";
+        _data_len = _frame_capacity * LEN_RAW_FRAME_BYTE;
+    }
+    return decode_frame_batch(_payload + LEN_RAW_HEADER_BYTE, _data_len, _frame_buf, get_payload_fec_id(_payload, _payload_len));
+}
+
+uint64_t SJSV_pcapreader::estimate_frame_num(uint64_t _byte_num, int64_t _packet_num) {
+    // * every payload byte after the raw header belongs to a 6-byte frame,
+    // * so the capture size without per-packet headers bounds the frame number from above
+    uint64_t _overhead = uint64_t(_packet_num) * (LEN_PCAP_RECORD_HEADER_BYTE + LEN_ETH_HEADER_BYTE + LEN_IPV4_MIN_HEADER_BYTE + LEN_UDP_HEADER_BYTE + LEN_RAW_HEADER_BYTE);
+    if (_byte_num <= _overhead)
+        return 0;
+    return (_byte_num - _overhead) / LEN_RAW_FRAME_BYTE;
+}
+
+uint64_t SJSV_pcapreader::reserve_frame_num(size_t _begin, size_t _end) const {
+    if (!is_packet_index_valid)
+        return std::min<uint64_t>(estimate_frame_num(_end - _begin, 0), DECODE_RESERVE_MAX_FRAME_NUM);
+
+    // * every record of the capture is indexed, so a record ends where the next one starts
+    auto _offset_less = [](const packet_index_entry &_entry, size_t _pos) { return _entry.offset() < _pos; };
+    auto _first = std::lower_bound(packet_index_vec.begin(), packet_index_vec.end(), _begin, _offset_less);
+    auto _last  = std::lower_bound(_first, packet_index_vec.end(), _end, _offset_less);
+    uint64_t _daq_byte_num = 0;
+    int64_t _daq_packet_num = 0;
+    for (auto _entry = _first; _entry != _last; ++_entry) {
+        if (!(_entry->flags() & PACKET_INDEX_FLAG_DAQ))
+            continue;
+        auto _next = _entry + 1 == packet_index_vec.end() ? mmap_len : (_entry + 1)->offset();
+        _daq_byte_num += std::min<uint64_t>(_next, _end) - _entry->offset();
+        _daq_packet_num++;
+    }
+    return estimate_frame_num(_daq_byte_num, _daq_packet_num);
+}
+
+std::string SJSV_pcapreader::frame_kernel_name() {
+    std::string _name;
+    get_frame_word_kernel(&_name);
+    return _name;
+}
+
+bool SJSV_pcapreader::set_frame_format(const std::string &_format_name) {
+    for (auto &_entry : frame_format_table) {
+        if (_format_name != _entry.format->name)
+            continue;
+        frame_format_ptr = _entry.format;
+        frame_decoder    = _entry.kernel;
+        LOG(INFO) << "Frame format: " << frame_format_ptr->name;
+        return true;
+    }
+    LOG(ERROR) << "Unknown frame format " << _format_name;
+    return false;
+}
+
+bool SJSV_pcapreader::probe_frame_format() {
+    // * the prefix of the capture is enough to reach the first DAQ packet
+    std::vector<uint8_t> _prefix(FRAME_FORMAT_PROBE_BYTE);
+    SJSV_pcapreader _first_file(expand_run_input() ? get_run_files().front() : filename);
+    auto _prefix_len = _first_file.read_file_prefix(_prefix.data(), _prefix.size());
+    if (_prefix_len < LEN_PCAP_GLOBAL_HEADER_BYTE || !_first_file.parse_pcap_global_header(_prefix.data())) {
+        LOG(ERROR) << "Cannot read the pcap header of " << filename;
         return false;
     }
 
+    size_t _pos = LEN_PCAP_GLOBAL_HEADER_BYTE;
+    while (_pos + LEN_PCAP_RECORD_HEADER_BYTE <= _prefix_len) {
+        auto _record = _prefix.data() + _pos;
+        uint32_t _caplen = _first_file.read_pcap_u32(_record + 8);
+        if (_caplen > _prefix_len - _pos - LEN_PCAP_RECORD_HEADER_BYTE)
+            break;
+        _pos += LEN_PCAP_RECORD_HEADER_BYTE + _caplen;
 
-    TFile* _rootfile = new TFile(_rootfilename.c_str(), "RECREATE");
-    if (_rootfile->IsZombie()) {
-        LOG(ERROR) << "Cannot open root file " << _rootfilename;
+        const uint8_t* _payload = nullptr;
+        uint32_t _payload_len = 0;
+        uint16_t _src_port = 0;
+        if (!_first_file.locate_udp_payload(_record + LEN_PCAP_RECORD_HEADER_BYTE, _caplen, _payload, _payload_len, _src_port))
+            continue;
+        if (_src_port != DAQ_DATA_SRC_PORT || _payload_len < LEN_RAW_HEADER_BYTE)
+            continue;
+
+        uint32_t _data_id = link_statistics::read_be_u32(_payload + 4) >> 8;
+        for (auto &_entry : frame_format_table) {
+            if (_entry.format->data_id != _data_id)
+                continue;
+            frame_format_ptr = _entry.format;
+            frame_decoder    = _entry.kernel;
+            LOG(INFO) << "Frame format: " << frame_format_ptr->name << " (probed)";
+            return true;
+        }
+        LOG(ERROR) << "No frame format for data id 0x" << std::hex << _data_id << std::dec;
         return false;
     }
+    LOG(ERROR) << "No DAQ packet found at the beginning of " << filename;
+    return false;
+}
 
-    TTree* _tree = new TTree("tree", "tree");
+std::vector<std::string> SJSV_pcapreader::get_frame_format_names() {
+    std::vector<std::string> _names;
+    for (auto &_entry : frame_format_table)
+        _names.push_back(_entry.format->name);
+    return _names;
+}
 
-    uint8_t  _offset;
-    uint8_t  _vmm_id;
-    uint16_t _adc;
-    uint16_t _bcid;
-    bool     _daqdata38;
-    uint8_t  _channel;
-    uint8_t  _tdc;
-    uint64_t _timestamp;
-    bool    _flag_daq;
+uint32_t SJSV_pcapreader::decode_frame_batch(const uint8_t* _frame_data, uint32_t _data_len, std::vector<uni_frame> &_frame_vec, uint8_t _fec_id) {
+    auto _vec_begin = _frame_vec.size();
+    _frame_vec.resize(_vec_begin + _data_len / LEN_RAW_FRAME_BYTE);
+    return decode_frame_batch(_frame_data, _data_len, _frame_vec.data() + _vec_begin, _fec_id);
+}
 
-    _tree->Branch("offset",    &_offset,    "offset/b");
-    _tree->Branch("vmm_id",    &_vmm_id,    "vmm_id/b");
-    _tree->Branch("adc",       &_adc,       "adc/s");
-    _tree->Branch("bcid",      &_bcid,      "bcid/s");
-    _tree->Branch("daqdata38", &_daqdata38, "daqdata38/O");
-    _tree->Branch("channel",   &_channel,   "channel/b");
-    _tree->Branch("tdc",       &_tdc,       "tdc/b");
-    _tree->Branch("timestamp", &_timestamp, "timestamp/l");
-    _tree->Branch("flag_daq",  &_flag_daq,  "flag_daq/O");
-
-    for (auto _frame : *uni_frame_vec) {
-        _offset    = _frame.offset;
-        _vmm_id    = _frame.vmm_id;
-        _adc       = _frame.adc;
-        _bcid      = _frame.bcid;
-        _daqdata38 = _frame.daqdata38;
-        _channel   = _frame.channel;
-        _tdc       = _frame.tdc;
-        _timestamp = _frame.timestamp;
-        _flag_daq  = _frame.flag_daq;
-        _tree->Fill();
+uint32_t SJSV_pcapreader::decode_frame_batch(const uint8_t* _frame_data, uint32_t _data_len, uni_frame* _out, uint8_t _fec_id) {
+    auto _kernel = simd_enabled ? get_frame_word_kernel() : frame_words_scalar;
+
+    uint32_t _frame_total = _data_len / LEN_RAW_FRAME_BYTE;
+
+    uint64_t _words[FRAME_BATCH_SIZE];
+    uint64_t _daq_mask;
+    for (uint32_t _batch_start = 0; _batch_start < _frame_total; _batch_start += FRAME_BATCH_SIZE) {
+        uint32_t _batch_len = std::min<uint32_t>(FRAME_BATCH_SIZE, _frame_total - _batch_start);
+        uint32_t _byte_start = _batch_start * LEN_RAW_FRAME_BYTE;
+        _kernel(_frame_data + _byte_start, _data_len - _byte_start, _batch_len, _words, _daq_mask);
+        frame_decoder(_words, _daq_mask, _batch_len, _out + _batch_start, _fec_id);
     }
+    return _frame_total;
+}
 
-    _rootfile->Write();
-    _rootfile->Close();
+bool SJSV_pcapreader::map_pcapfile() {
+    unmap_pcapfile();
+
+    int _fd = open(filename.c_str(), O_RDONLY);
+    if (_fd < 0) {
+        LOG(ERROR) << "Cannot open file " << filename;
+        return false;
+    }
+
+    struct stat _file_stat;
+    if (fstat(_fd, &_file_stat) != 0 || _file_stat.st_size < LEN_PCAP_GLOBAL_HEADER_BYTE) {
+        LOG(WARNING) << "File " << filename << " is too short for a pcap file";
+        close(_fd);
+        return false;
+    }
+
+    auto _map = mmap(nullptr, _file_stat.st_size, PROT_READ, MAP_PRIVATE, _fd, 0);
+    close(_fd);
+    if (_map == MAP_FAILED) {
+        LOG(ERROR) << "Cannot map file " << filename;
+        return false;
+    }
+    madvise(_map, _file_stat.st_size, MADV_SEQUENTIAL);
+
+    mmap_data = static_cast<const uint8_t*>(_map);
+    mmap_len  = _file_stat.st_size;
 
+    if (!parse_pcap_global_header(mmap_data)) {
+        LOG(INFO) << "File " << filename << " is not a classic pcap file";
+        unmap_pcapfile();
+        return false;
+    }
+    mmap_first_ts = mmap_len >= LEN_PCAP_GLOBAL_HEADER_BYTE + LEN_PCAP_RECORD_HEADER_BYTE ? read_pcap_u32(mmap_data + LEN_PCAP_GLOBAL_HEADER_BYTE) : 0;
     return true;
 }
 
-std::string SJSV_pcapreader::test_single_frame_decode(const std::vector<uint8_t> &_test_frame) {
-    auto _frame = this->decode_single_frame(_test_frame);
+bool SJSV_pcapreader::parse_pcap_global_header(const uint8_t* _header) {
+    uint32_t _magic;
+    memcpy(&_magic, _header, sizeof(_magic));
+    switch (_magic) {
+        case 0xA1B2C3D4: mmap_swapped = false; mmap_nanosec = false; break;
+        case 0xD4C3B2A1: mmap_swapped = true;  mmap_nanosec = false; break;
+        case 0xA1B23C4D: mmap_swapped = false; mmap_nanosec = true;  break;
+        case 0x4D3CB2A1: mmap_swapped = true;  mmap_nanosec = true;  break;
+        default:
+            return false;
+    }
+    mmap_snaplen  = read_pcap_u32(_header + 16);
+    mmap_linktype = read_pcap_u32(_header + 20) & 0x0FFFFFFF;
+    return true;
+}
 
-    std::string _str = "";
-    _str += "offset:    " + std::to_string(_frame.offset) + "\n";
-    _str += "vmm_id:    " + std::to_string(_frame.vmm_id) + "\n";
-    _str += "adc:       " + std::to_string(_frame.adc) + "\n";
-    _str += "bcid:      " + std::to_string(_frame.bcid) + "\n";
-    _str += "daqdata38: " + std::to_string(_frame.daqdata38) + "\n";
-    _str += "channel:   " + std::to_string(_frame.channel) + "\n";
-    _str += "tdc:       " + std::to_string(_frame.tdc) + "\n";
-    _str += "timestamp: " + std::to_string(_frame.timestamp) + "\n";
-    _str += "flag_daq:  " + std::to_string(_frame.flag_daq) + "\n";
+void SJSV_pcapreader::unmap_pcapfile() {
+    if (mmap_data != nullptr) {
+        munmap(const_cast<uint8_t*>(mmap_data), mmap_len);
+        mmap_data = nullptr;
+        mmap_len  = 0;
+    }
+}
 
-    return _str;
+bool SJSV_pcapreader::locate_udp_payload(const uint8_t* _packet, uint32_t _caplen, const uint8_t* &_payload, uint32_t &_payload_len, uint16_t &_src_port) {
+    // * fast path: untagged Ethernet II, unfragmented IPv4, UDP
+    if (mmap_linktype != pcpp::LINKTYPE_ETHERNET)
+        return false;
+    if (_caplen < LEN_ETH_HEADER_BYTE + LEN_IPV4_MIN_HEADER_BYTE + LEN_UDP_HEADER_BYTE)
+        return false;
+    if (_packet[12] != 0x08 || _packet[13] != 0x00)
+        return false;
+
+    auto _ip = _packet + LEN_ETH_HEADER_BYTE;
+    uint32_t _ip_header_len = (_ip[0] & 0x0F) * 4;
+    if ((_ip[0] >> 4) != 4 || _ip_header_len < LEN_IPV4_MIN_HEADER_BYTE)
+        return false;
+    if (_ip[9] != 17)
+        return false;
+    if (((_ip[6] << 8) + _ip[7]) & 0x3FFF)
+        return false;
+
+    uint32_t _udp_offset = LEN_ETH_HEADER_BYTE + _ip_header_len;
+    if (_caplen < _udp_offset + LEN_UDP_HEADER_BYTE)
+        return false;
+
+    auto _udp = _packet + _udp_offset;
+    uint32_t _udp_len = (_udp[4] << 8) + _udp[5];
+    if (_udp_len < LEN_UDP_HEADER_BYTE)
+        return false;
+
+    _src_port    = (_udp[0] << 8) + _udp[1];
+    _payload     = _udp + LEN_UDP_HEADER_BYTE;
+    _payload_len = std::min(_udp_len - LEN_UDP_HEADER_BYTE, _caplen - _udp_offset - LEN_UDP_HEADER_BYTE);
+    return true;
 }
 
-SJSV_pcapreader::uni_frame SJSV_pcapreader::decode_single_frame(uint8_t _byte0, uint8_t _byte1, uint8_t _byte2, uint8_t _byte3, uint8_t _byte4, uint8_t _byte5) {
-    uni_frame _frame;
-    uint32_t _data1 = (_byte0 << 24) + (_byte1 << 16) + (_byte2 << 8) + _byte3;
-    uint16_t _data2 = (_byte4 << 8) + _byte5;
-
-    _frame.flag_daq = (_data2 >> 15) & 0x1;
-        if (_frame.flag_daq) {
-            _frame.offset    = (_data1 >> 27) & 0x1F;
-            _frame.vmm_id    = (_data1 >> 22) & 0x1F;
-            _frame.adc       = (_data1 >> 12) & 0x3FF;
-            _frame.bcid      = Gray2bin32(_data1 & 0xFFF);
-            _frame.daqdata38 = (_data2 >> 14) & 0x1;
-            _frame.channel   = (_data2 >> 8) & 0x3f;
-            _frame.tdc       = _data2 & 0xFF;
-            _frame.timestamp = 0;
-        } else {
-            _frame.offset    = 0;
-            _frame.vmm_id    = 0;
-            _frame.adc       = 0;
-            _frame.bcid      = 0;
-            _frame.daqdata38 = 0;
-            _frame.channel   = 0;
-            _frame.tdc       = 0;
-            uint64_t timestamp_lower_10bit = _data2 & 0x03FF;
-            uint64_t timestamp_upper_32bit = _data1;
-            _frame.timestamp = (timestamp_upper_32bit << 10) + timestamp_lower_10bit;
+size_t SJSV_pcapreader::scan_pcap_range(size_t _begin, size_t _end, range_decode_result &_result, const payload_callback &_callback, const std::atomic<bool>* _stop) {
+    size_t _pos = _begin;
+    while (_pos < _end && _pos + LEN_PCAP_RECORD_HEADER_BYTE <= mmap_len) {
+        if (_stop != nullptr && _stop->load(std::memory_order_relaxed))
+            break;
+        auto _record = mmap_data + _pos;
+        uint32_t _caplen = read_pcap_u32(_record + 8);
+        if (_caplen > mmap_len - _pos - LEN_PCAP_RECORD_HEADER_BYTE) {
+            LOG(WARNING) << "Truncated packet record at byte " << _pos;
+            _result.truncated = true;
+            break;
         }
+        _pos += LEN_PCAP_RECORD_HEADER_BYTE + _caplen;
+        process_pcap_record(_record, _caplen, _result, _callback);
+    }
+    _result.end_pos = _pos;
+    return _pos;
+}
+
+void SJSV_pcapreader::process_pcap_record(const uint8_t* _record, uint32_t _caplen, range_decode_result &_result, const payload_callback &_callback) {
+    auto _packet = _record + LEN_PCAP_RECORD_HEADER_BYTE;
+    _result.capture_time_ns = record_time_ns(_record);
+    const uint8_t* _payload = nullptr;
+    uint32_t _payload_len = 0;
+    uint16_t _src_port = 0;
+    if (locate_udp_payload(_packet, _caplen, _payload, _payload_len, _src_port)) {
+        _result.stats.packet_num++;
+        _result.stats.eth_packet_num++;
+        _result.stats.ip_packet_num++;
+        _result.stats.udp_packet_num++;
+        if (_src_port != DAQ_DATA_SRC_PORT)
+            return;
+        _result.stats.daq_packet_num++;
+    } else {
+        // * unusual encapsulation, let PcapPlusPlus parse the layers
+        _result.fallback_packet_num++;
+        timeval _timestamp;
+        _timestamp.tv_sec  = read_pcap_u32(_record);
+        _timestamp.tv_usec = mmap_nanosec ? read_pcap_u32(_record + 4) / 1000 : read_pcap_u32(_record + 4);
+        pcpp::RawPacket rawPacket(_packet, _caplen, _timestamp, false, pcpp::LinkLayerType(mmap_linktype));
+        pcpp::Packet parsedPacket(&rawPacket);
+        pcpp::UdpLayer* udpLayer = count_packet_layers(parsedPacket, _result.stats);
+        if (udpLayer == NULL || udpLayer->getSrcPort() != DAQ_DATA_SRC_PORT)
+            return;
+        _payload     = udpLayer->getLayerPayload();
+        _payload_len = udpLayer->getLayerPayloadSize();
+    }
 
+    _callback(_payload, _payload_len);
+}
+
+void SJSV_pcapreader::decode_daq_payload(const uint8_t* _payload, uint32_t _payload_len, std::vector<uni_frame> &_frame_vec, range_decode_result &_result, packed_frame_store* _packed_store) {
+    auto _frame_begin = _frame_vec.size();
+    _result.link_stats.add_packet(_payload, _payload_len, _result.capture_time_ns);
+    _result.frame_num += decode_pcap_packet(_payload, _payload_len, _frame_vec);
+    for (auto i = _frame_begin; i < _frame_vec.size(); i++) {
+        if (_frame_vec[i].flag_daq)
+            _result.daq_frame_num++;
+        else
+            _result.time_frame_num++;
+    }
+    if (_packed_store != nullptr) {
+        _packed_store->append(_frame_vec.data() + _frame_begin, _frame_vec.size() - _frame_begin);
+        _frame_vec.resize(_frame_begin);
+    }
+}
+
+size_t SJSV_pcapreader::decode_pcap_range(size_t _begin, size_t _end, std::vector<uni_frame> &_frame_vec, range_decode_result &_result, packed_frame_store* _packed_store) {
+    return scan_pcap_range(_begin, _end, _result, [&](const uint8_t* _payload, uint32_t _payload_len) {
+        decode_daq_payload(_payload, _payload_len, _frame_vec, _result, _packed_store);
+    });
+}
+
+int64_t SJSV_pcapreader::for_each_daq_payload(const payload_callback &_callback, const std::atomic<bool>* _stop) {
+    return for_each_daq_packet([&](uint64_t, const uint8_t* _payload, uint32_t _payload_len) {
+        _callback(_payload, _payload_len);
+    }, _stop);
+}
+
+int64_t SJSV_pcapreader::for_each_daq_packet(const timed_payload_callback &_callback, const std::atomic<bool>* _stop) {
+    if (filename.empty()) {
+        LOG(ERROR) << "Filename is empty";
+        return -1;
+    }
+    if (expand_run_input())
+        return for_each_run_payload(_callback, _stop);
+
+    range_decode_result _result;
+    link_statistics _window_start;
+    uint64_t _next_dump_ns = 0;
+    auto _record_callback = [&](const uint8_t* _payload, uint32_t _payload_len) {
+        _result.link_stats.add_packet(_payload, _payload_len, _result.capture_time_ns);
+        if (link_stats_dump_interval_ns > 0)
+            dump_link_window(_result.link_stats, _window_start, _next_dump_ns);
+        _callback(_result.capture_time_ns, _payload, _payload_len);
+    };
+    bool _is_scanned = false;
+    auto _compression = detect_input_compression();
+    if (_compression != INPUT_UNCOMPRESSED || prefetch_read_num > 0) {
+        _is_scanned = scan_chunked_pcapfile(_compression, _result, _record_callback, _stop);
+    } else if (map_pcapfile()) {
+        scan_pcap_range(LEN_PCAP_GLOBAL_HEADER_BYTE, mmap_len, _result, _record_callback, _stop);
+        unmap_pcapfile();
+        _is_scanned = true;
+    }
+
+    if (_is_scanned) {
+        pcap_stats = _result.stats;
+        if (_result.fallback_packet_num > 0)
+            LOG(INFO) << _result.fallback_packet_num << " packets parsed by PcapPlusPlus";
+    } else {
+        LOG(WARNING) << "Falling back to PcapPlusPlus reader for " << filename;
+        if (!read_pcapfile(false))
+            return -1;
+        pcap_stats = pcap_statistics();
+        _result.link_stats = link_statistics();
+        pcpp::RawPacket rawPacket;
+        while ((_stop == nullptr || !_stop->load(std::memory_order_relaxed)) && reader->getNextPacket(rawPacket)) {
+            pcpp::Packet parsedPacket(&rawPacket);
+            pcpp::UdpLayer* udpLayer = count_packet_layers(parsedPacket, pcap_stats);
+            if (udpLayer == NULL || udpLayer->getSrcPort() != DAQ_DATA_SRC_PORT)
+                continue;
+            auto _timestamp = rawPacket.getPacketTimeStamp();
+            _result.capture_time_ns = uint64_t(_timestamp.tv_sec) * 1000000000ULL + _timestamp.tv_nsec;
+            _record_callback(udpLayer->getLayerPayload(), udpLayer->getLayerPayloadSize());
+        }
+    }
+    link_stats = _result.link_stats;
+
+    if (pcap_stats.daq_packet_num == 0) {
+        LOG(ERROR) << "Cannot find any DAQ packet";
+        return -1;
+    }
+    log_pcap_statistics();
+    log_link_statistics();
+    return pcap_stats.daq_packet_num;
+}
+
+int64_t SJSV_pcapreader::for_each_sampled_payload(double _fraction, int _block_num, const payload_callback &_callback, const sample_block_callback &_block_callback) {
+    if (filename.empty()) {
+        LOG(ERROR) << "Filename is empty";
+        return -1;
+    }
+    if (expand_run_input()) {
+        LOG(ERROR) << "Sampling a multi-file run is not supported, select one capture file";
+        return -1;
+    }
+    if (detect_input_compression() != INPUT_UNCOMPRESSED) {
+        LOG(ERROR) << "Compressed captures cannot be sampled, the blocks cannot be reached by seeking";
+        return -1;
+    }
+    if (!map_pcapfile())
+        return -1;
+    // * only the sampled blocks are touched, read-ahead of the whole file is wasted
+    madvise(const_cast<uint8_t*>(mmap_data), mmap_len, MADV_RANDOM);
+
+    _fraction  = std::min(std::max(_fraction, 0.0), 1.0);
+    _block_num = std::max(_block_num, 1);
+
+    // * block begins and ends, a block ends with the last record starting before its end
+    std::vector<std::pair<size_t, size_t>> _blocks;
+    if (is_packet_index_valid && !packet_index_vec.empty()) {
+        int64_t _packet_num = packet_index_vec.size();
+        int64_t _block_packet_num = std::max<int64_t>(1, int64_t(_packet_num * _fraction / _block_num));
+        for (int i = 0; i < _block_num; i++) {
+            int64_t _first = _packet_num * i / _block_num;
+            int64_t _last  = std::min(_first + _block_packet_num, _packet_num);
+            _blocks.push_back({packet_index_vec[_first].offset(), _last < _packet_num ? packet_index_vec[_last].offset() : mmap_len});
+        }
+    } else {
+        size_t _data_len = mmap_len - LEN_PCAP_GLOBAL_HEADER_BYTE;
+        size_t _block_byte_num = std::max<size_t>(1, size_t(_data_len * _fraction / _block_num));
+        for (int i = 0; i < _block_num; i++) {
+            size_t _target = LEN_PCAP_GLOBAL_HEADER_BYTE + _data_len * i / _block_num;
+            size_t _limit  = std::min(mmap_len, _target + PCAP_RESYNC_WINDOW_BYTE);
+            for (size_t _pos = _target; _pos < _limit; _pos++) {
+                if (is_pcap_record(_pos)) {
+                    _blocks.push_back({_pos, std::min(mmap_len, _pos + _block_byte_num)});
+                    break;
+                }
+            }
+        }
+    }
+
+    range_decode_result _result;
+    size_t _sampled_byte_num = 0;
+    for (size_t i = 0; i < _blocks.size(); i++) {
+        // * blocks may overlap for large fractions, records already visited are skipped
+        size_t _begin = std::max(_blocks[i].first, _result.end_pos);
+        if (_begin >= _blocks[i].second)
+            continue;
+        if (_block_callback)
+            _block_callback(int(i));
+        scan_pcap_range(_begin, _blocks[i].second, _result, _callback);
+        _sampled_byte_num += _result.end_pos - _begin;
+    }
+    size_t _file_byte_num = mmap_len;
+    unmap_pcapfile();
+
+    pcap_stats = _result.stats;
+    if (pcap_stats.daq_packet_num == 0) {
+        LOG(ERROR) << "Cannot find any DAQ packet in the sampled blocks";
+        return -1;
+    }
+    LOG(INFO) << "Sampled " << _blocks.size() << " blocks, " << _sampled_byte_num / 1024 << " kB of " << _file_byte_num / 1024 << " kB";
+    log_pcap_statistics();
+    return pcap_stats.daq_packet_num;
+}
+
+bool SJSV_pcapreader::is_pcap_record(size_t _pos) {
+    // * a candidate is accepted only if a chain of plausible record headers follows it
+    for (int i = 0; i < PCAP_RESYNC_CHAIN_LEN; i++) {
+        if (_pos == mmap_len)
+            return true;
+        if (_pos + LEN_PCAP_RECORD_HEADER_BYTE > mmap_len)
+            return false;
+        auto _record = mmap_data + _pos;
+        uint32_t _ts_sec  = read_pcap_u32(_record);
+        uint32_t _ts_frac = read_pcap_u32(_record + 4);
+        uint32_t _caplen  = read_pcap_u32(_record + 8);
+        uint32_t _origlen = read_pcap_u32(_record + 12);
+        if (_caplen == 0 || _caplen > _origlen || _caplen > mmap_snaplen)
+            return false;
+        if (_ts_frac >= (mmap_nanosec ? 1000000000u : 1000000u))
+            return false;
+        if (std::abs(int64_t(_ts_sec) - int64_t(mmap_first_ts)) > PCAP_RESYNC_MAX_TIME_SPAN_S)
+            return false;
+        if (_caplen > mmap_len - _pos - LEN_PCAP_RECORD_HEADER_BYTE)
+            return false;
+        _pos += LEN_PCAP_RECORD_HEADER_BYTE + _caplen;
+    }
+    return true;
+}
+
+std::vector<size_t> SJSV_pcapreader::find_range_offsets(int _range_num) {
+    std::vector<size_t> _offsets = {LEN_PCAP_GLOBAL_HEADER_BYTE};
+    if (is_packet_index_valid && !packet_index_vec.empty()) {
+        auto _packet_num = packet_index_vec.size();
+        for (int i = 1; i < _range_num; i++) {
+            auto _offset = packet_index_vec[_packet_num * i / _range_num].offset();
+            if (_offset > _offsets.back())
+                _offsets.push_back(_offset);
+        }
+        _offsets.push_back(mmap_len);
+        return _offsets;
+    }
+
+    auto _data_len = mmap_len - LEN_PCAP_GLOBAL_HEADER_BYTE;
+    for (int i = 1; i < _range_num; i++) {
+        size_t _target = LEN_PCAP_GLOBAL_HEADER_BYTE + _data_len * i / _range_num;
+        _target = std::max(_target, _offsets.back() + 1);
+        size_t _limit = std::min(mmap_len, _target + PCAP_RESYNC_WINDOW_BYTE);
+        for (size_t _pos = _target; _pos < _limit; _pos++) {
+            if (is_pcap_record(_pos)) {
+                _offsets.push_back(_pos);
+                break;
+            }
+        }
+    }
+    _offsets.push_back(mmap_len);
+    return _offsets;
+}
+
+int64_t SJSV_pcapreader::mmap_decode_pcapfile() {
+    if (filename.empty()) {
+        LOG(ERROR) << "Filename is empty";
+        return -1;
+    }
+
+    if (expand_run_input())
+        return decode_run_files();
+
+    auto _compression = detect_input_compression();
+    if (_compression != INPUT_UNCOMPRESSED || prefetch_read_num > 0)
+        return stream_decode_pcapfile(_compression);
+
+    if (!map_pcapfile()) {
+        LOG(WARNING) << "Falling back to PcapPlusPlus reader for " << filename;
+        return single_pass_decode_pcapfile();
+    }
+
+    is_uniframe_vec_valid = false;
+    auto _vec_begin = uni_frame_vec->size();
+    auto _packed_begin = packed_frames.hit_word_vec.size();
+
+    std::vector<size_t> _range_offsets = {LEN_PCAP_GLOBAL_HEADER_BYTE, mmap_len};
+    if (thread_num > 1)
+        _range_offsets = find_range_offsets(thread_num);
+    auto _range_num = _range_offsets.size() - 1;
+    std::vector<range_decode_result> _results(_range_num);
+
+    if (_range_num > 1) {
+        // * each range is decoded into its own block, blocks are concatenated in packet order
+        std::vector<std::vector<uni_frame>> _blocks(_range_num);
+        std::vector<packed_frame_store> _packed_blocks(packed_storage_enabled ? _range_num : 0);
+        std::vector<std::thread> _workers;
+        for (size_t i = 0; i < _range_num; i++) {
+            _workers.emplace_back([this, i, &_range_offsets, &_blocks, &_packed_blocks, &_results]() {
+                auto _frame_num = reserve_frame_num(_range_offsets[i], _range_offsets[i + 1]);
+                if (packed_storage_enabled) {
+                    _packed_blocks[i].reserve(_frame_num);
+                    decode_pcap_range(_range_offsets[i], _range_offsets[i + 1], _blocks[i], _results[i], &_packed_blocks[i]);
+                } else {
+                    _blocks[i].reserve(_frame_num);
+                    decode_pcap_range(_range_offsets[i], _range_offsets[i + 1], _blocks[i], _results[i]);
+                }
+            });
+        }
+        for (auto &_worker : _workers)
+            _worker.join();
+
+        bool _is_aligned = true;
+        for (size_t i = 0; i + 1 < _range_num; i++) {
+            if (_results[i].end_pos != _range_offsets[i + 1])
+                _is_aligned = false;
+        }
+
+        if (_is_aligned && packed_storage_enabled) {
+            for (auto &_packed_block : _packed_blocks) {
+                packed_frames.append(_packed_block);
+                _packed_block.release();
+            }
+            LOG(INFO) << "Decoded " << _range_num << " packet ranges in parallel";
+        } else if (_is_aligned) {
+            // * the total is reserved once and every block is released as soon as it is appended
+            size_t _block_frame_num = 0;
+            for (auto &_block : _blocks)
+                _block_frame_num += _block.size();
+            uni_frame_vec->reserve(_vec_begin + _block_frame_num);
+            for (auto &_block : _blocks) {
+                uni_frame_vec->insert(uni_frame_vec->end(), _block.begin(), _block.end());
+                std::vector<uni_frame>().swap(_block);
+            }
+            LOG(INFO) << "Decoded " << _range_num << " packet ranges in parallel";
+        } else {
+            LOG(WARNING) << "Packet ranges are not aligned to records, decoding serially";
+            _range_num = 1;
+        }
+    }
+
+    if (_range_num == 1) {
+        _results.assign(1, range_decode_result());
+        auto _frame_num = reserve_frame_num(LEN_PCAP_GLOBAL_HEADER_BYTE, mmap_len);
+        if (packed_storage_enabled) {
+            std::vector<uni_frame> _scratch_vec;
+            packed_frames.reserve(_packed_begin + _frame_num);
+            decode_pcap_range(LEN_PCAP_GLOBAL_HEADER_BYTE, mmap_len, _scratch_vec, _results[0], &packed_frames);
+        } else {
+            uni_frame_vec->reserve(_vec_begin + _frame_num);
+            decode_pcap_range(LEN_PCAP_GLOBAL_HEADER_BYTE, mmap_len, *uni_frame_vec, _results[0]);
+        }
+    }
+
+    unmap_pcapfile();
+    return summarize_decode_results(_results);
+}
+
+int64_t SJSV_pcapreader::stream_frame_blocks(const frame_block_callback &_consumer) {
+    if (filename.empty()) {
+        LOG(ERROR) << "Filename is empty";
+        return -1;
+    }
+
+    // * the producer fills one block and the consumer holds one, the rest of the cap is queued
+    size_t _block_cap = stream_memory_cap / (stream_block_frame_num * sizeof(uni_frame));
+    size_t _queue_len = _block_cap > 3 ? _block_cap - 2 : 1;
+    SJSV_boundedqueue<std::vector<uni_frame>> _block_queue(_queue_len);
+    SJSV_boundedqueue<std::vector<uni_frame>> _free_queue(_queue_len + 2);
+
+    int64_t _packet_num = -1;
+    std::atomic<bool> _is_stopped(false);
+    std::thread _producer([&]() {
+        std::vector<uni_frame> _block;
+        _block.reserve(stream_block_frame_num);
+        // * once the consumer stops, the reader stops at the next record instead of scanning the rest
+        _packet_num = for_each_daq_payload([&](const uint8_t* _payload, uint32_t _payload_len) {
+            if (_is_stopped.load(std::memory_order_relaxed) || _payload_len <= LEN_RAW_HEADER_BYTE)
+                return;
+            auto _frame_data = _payload + LEN_RAW_HEADER_BYTE;
+            auto _fec_id = get_payload_fec_id(_payload, _payload_len);
+            uint32_t _frame_total = (_payload_len - LEN_RAW_HEADER_BYTE) / LEN_RAW_FRAME_BYTE;
+            uint32_t _frame_done = 0;
+            // * a packet may be split over two blocks, the frame order is kept
+            while (_frame_done < _frame_total) {
+                uint32_t _frame_num = std::min<size_t>(_frame_total - _frame_done, stream_block_frame_num - _block.size());
+                decode_frame_batch(_frame_data + _frame_done * LEN_RAW_FRAME_BYTE, _frame_num * LEN_RAW_FRAME_BYTE, _block, _fec_id);
+                _frame_done += _frame_num;
+                if (_block.size() == stream_block_frame_num) {
+                    if (!_block_queue.push(std::move(_block))) {
+                        _is_stopped = true;
+                        return;
+                    }
+                    _block.clear();
+                    if (!_free_queue.try_pop(_block))
+                        _block.reserve(stream_block_frame_num);
+                }
+            }
+        }, &_is_stopped);
+        if (!_block.empty() && !_is_stopped)
+            _block_queue.push(std::move(_block));
+        _block_queue.close();
+    });
+
+    int64_t _frame_num = 0;
+    int64_t _block_num = 0;
+    std::vector<uni_frame> _block;
+    while (_block_queue.pop(_block)) {
+        _frame_num += _block.size();
+        _block_num++;
+        if (!_consumer(_block)) {
+            LOG(INFO) << "Frame stream stopped by the consumer";
+            _is_stopped = true;
+            _block_queue.close();
+            break;
+        }
+        _block.clear();
+        _free_queue.try_push(std::move(_block));
+    }
+    _producer.join();
+
+    if (_packet_num < 0)
+        return -1;
+    LOG(INFO) << "Streamed " << _frame_num << " frames in " << _block_num << " blocks";
+    return _frame_num;
+}
+
+int64_t SJSV_pcapreader::summarize_decode_results(const std::vector<range_decode_result> &_results) {
+    pcap_stats = pcap_statistics();
+    link_stats = link_statistics();
+    int64_t _length_vec = 0;
+    int64_t _daq_frame_num = 0;
+    int64_t _time_frame_num = 0;
+    int64_t _fallback_packet_num = 0;
+    for (auto &_result : _results) {
+        pcap_stats.packet_num     += _result.stats.packet_num;
+        pcap_stats.eth_packet_num += _result.stats.eth_packet_num;
+        pcap_stats.ip_packet_num  += _result.stats.ip_packet_num;
+        pcap_stats.udp_packet_num += _result.stats.udp_packet_num;
+        pcap_stats.daq_packet_num += _result.stats.daq_packet_num;
+        link_stats.merge(_result.link_stats);
+        _length_vec          += _result.frame_num;
+        _daq_frame_num       += _result.daq_frame_num;
+        _time_frame_num      += _result.time_frame_num;
+        _fallback_packet_num += _result.fallback_packet_num;
+    }
+
+    if (_length_vec == 0) {
+        LOG(ERROR) << "Cannot find any DAQ packet";
+        return -1;
+    }
+
+    log_pcap_statistics();
+    log_link_statistics();
+    if (_fallback_packet_num > 0)
+        LOG(INFO) << _fallback_packet_num << " packets parsed by PcapPlusPlus";
+    LOG(INFO) << "DAQ frame number:  " << _daq_frame_num;
+    LOG(INFO) << "Time frame number: " << _time_frame_num;
+    if (packed_storage_enabled)
+        LOG(INFO) << "Packed frame store: " << packed_frames.memory_usage() / (1024 * 1024) << " MB";
+
+    is_uniframe_vec_valid = true;
+    return _length_vec;
+}
+
+SJSV_pcapreader::input_compression SJSV_pcapreader::detect_input_compression() const {
+    std::ifstream _file(filename, std::ios::binary);
+    uint8_t _magic[4] = {0, 0, 0, 0};
+    if (!_file.read(reinterpret_cast<char*>(_magic), sizeof(_magic)))
+        return INPUT_UNCOMPRESSED;
+    if (_magic[0] == 0x1F && _magic[1] == 0x8B)
+        return INPUT_GZIP;
+    if (_magic[0] == 0x28 && _magic[1] == 0xB5 && _magic[2] == 0x2F && _magic[3] == 0xFD)
+        return INPUT_ZSTD;
+    return INPUT_UNCOMPRESSED;
+}
+
+typedef SJSV_boundedqueue<std::vector<uint8_t>> chunk_queue;
+
+// * Take a recycled chunk buffer if one is available
+static std::vector<uint8_t> take_chunk(chunk_queue &_free_queue) {
+    std::vector<uint8_t> _chunk;
+    _free_queue.try_pop(_chunk);
+    _chunk.resize(STREAM_CHUNK_SIZE_BYTE);
+    return _chunk;
+}
+
+#ifdef SJSV_WITH_ZLIB
+static bool gzip_decompress_file(const std::string &_filename, chunk_queue &_chunk_queue, chunk_queue &_free_queue) {
+    gzFile _file = gzopen(_filename.c_str(), "rb");
+    if (_file == NULL) {
+        LOG(ERROR) << "Cannot open file " << _filename;
+        return false;
+    }
+    gzbuffer(_file, STREAM_CHUNK_SIZE_BYTE);
+
+    bool _is_complete = true;
+    while (true) {
+        auto _chunk = take_chunk(_free_queue);
+        int _read_len = gzread(_file, _chunk.data(), _chunk.size());
+        if (_read_len < 0) {
+            int _errnum = 0;
+            LOG(ERROR) << "Cannot decompress " << _filename << ": " << gzerror(_file, &_errnum);
+            _is_complete = false;
+            break;
+        }
+        if (_read_len == 0)
+            break;
+        _chunk.resize(_read_len);
+        if (!_chunk_queue.push(std::move(_chunk)))
+            break;
+    }
+    gzclose(_file);
+    return _is_complete;
+}
+#endif
+
+#ifdef SJSV_WITH_ZSTD
+static bool zstd_decompress_file(const std::string &_filename, chunk_queue &_chunk_queue, chunk_queue &_free_queue) {
+    FILE* _file = fopen(_filename.c_str(), "rb");
+    if (_file == NULL) {
+        LOG(ERROR) << "Cannot open file " << _filename;
+        return false;
+    }
+    ZSTD_DStream* _dstream = ZSTD_createDStream();
+    ZSTD_initDStream(_dstream);
+
+    std::vector<uint8_t> _in_buf(ZSTD_DStreamInSize());
+    auto _chunk = take_chunk(_free_queue);
+    ZSTD_outBuffer _out = {_chunk.data(), _chunk.size(), 0};
+
+    bool _is_complete = true;
+    bool _is_consumer_open = true;
+    size_t _frame_remain = 0;
+    size_t _read_len;
+    while (_is_consumer_open && (_read_len = fread(_in_buf.data(), 1, _in_buf.size(), _file)) > 0) {
+        ZSTD_inBuffer _in = {_in_buf.data(), _read_len, 0};
+        while (true) {
+            _frame_remain = ZSTD_decompressStream(_dstream, &_out, &_in);
+            if (ZSTD_isError(_frame_remain)) {
+                LOG(ERROR) << "Cannot decompress " << _filename << ": " << ZSTD_getErrorName(_frame_remain);
+                _is_complete = false;
+                _is_consumer_open = false;
+                break;
+            }
+            // * a full output buffer may leave data inside the decoder, call again after handing it over
+            bool _is_out_full = _out.pos == _out.size;
+            if (_is_out_full) {
+                if (!_chunk_queue.push(std::move(_chunk))) {
+                    _is_consumer_open = false;
+                    break;
+                }
+                _chunk = take_chunk(_free_queue);
+                _out = {_chunk.data(), _chunk.size(), 0};
+            }
+            if (_in.pos == _in.size && !_is_out_full)
+                break;
+        }
+    }
+    if (_is_consumer_open && _out.pos > 0) {
+        _chunk.resize(_out.pos);
+        _chunk_queue.push(std::move(_chunk));
+    }
+    if (_is_complete && _frame_remain != 0) {
+        LOG(WARNING) << "File " << _filename << " ends inside a zstd frame";
+        _is_complete = false;
+    }
+
+    ZSTD_freeDStream(_dstream);
+    fclose(_file);
+    return _is_complete;
+}
+#endif
+
+static bool decompress_file(const std::string &_filename, SJSV_pcapreader::input_compression _compression, chunk_queue &_chunk_queue, chunk_queue &_free_queue) {
+    switch (_compression) {
+        case SJSV_pcapreader::INPUT_GZIP:
+#ifdef SJSV_WITH_ZLIB
+            return gzip_decompress_file(_filename, _chunk_queue, _free_queue);
+#else
+            LOG(ERROR) << "Built without zlib, cannot read " << _filename;
+            return false;
+#endif
+        case SJSV_pcapreader::INPUT_ZSTD:
+#ifdef SJSV_WITH_ZSTD
+            return zstd_decompress_file(_filename, _chunk_queue, _free_queue);
+#else
+            LOG(ERROR) << "Built without zstd, cannot read " << _filename;
+            return false;
+#endif
+        default:
+            return false;
+    }
+}
+
+bool SJSV_pcapreader::scan_chunked_pcapfile(input_compression _compression, range_decode_result &_result, const payload_callback &_callback, const std::atomic<bool>* _stop) {
+    chunk_queue _chunk_queue(STREAM_QUEUE_LEN);
+    chunk_queue _free_queue(STREAM_QUEUE_LEN + std::max(prefetch_read_num, 1));
+
+    // * reading runs ahead of the parser by at most STREAM_QUEUE_LEN chunks
+    bool _is_decompressed = false;
+    std::thread _producer([&]() {
+        if (_compression == INPUT_UNCOMPRESSED) {
+            SJSV_prefetchreader _prefetcher(filename, std::max(prefetch_read_num, 1));
+            _is_decompressed = _prefetcher.read_file(_chunk_queue, _free_queue);
+        } else {
+            _is_decompressed = decompress_file(filename, _compression, _chunk_queue, _free_queue);
+        }
+        _chunk_queue.close();
+    });
+
+    // * records crossing a chunk boundary are completed from the next chunk,
+    // * at most one partial record is carried in _buf
+    std::vector<uint8_t> _buf;
+    std::vector<uint8_t> _chunk;
+    bool _is_header_read = false;
+    bool _is_pcap = true;
+    uint64_t _byte_num = 0;
+    bool _is_stopped = false;
+    while (_chunk_queue.pop(_chunk)) {
+        _byte_num += _chunk.size();
+        if (_buf.empty()) {
+            _buf.swap(_chunk);
+        } else {
+            _buf.insert(_buf.end(), _chunk.begin(), _chunk.end());
+        }
+        _free_queue.try_push(std::move(_chunk));
+
+        size_t _pos = 0;
+        if (!_is_header_read) {
+            if (_buf.size() < LEN_PCAP_GLOBAL_HEADER_BYTE)
+                continue;
+            if (!parse_pcap_global_header(_buf.data())) {
+                LOG(WARNING) << filename << " is not a classic pcap file";
+                _is_pcap = false;
+                break;
+            }
+            _is_header_read = true;
+            _pos = LEN_PCAP_GLOBAL_HEADER_BYTE;
+        }
+
+        uint32_t _caplen_limit = std::max<uint32_t>(mmap_snaplen, PCAP_STREAM_MAX_CAPLEN_BYTE);
+        while (_pos + LEN_PCAP_RECORD_HEADER_BYTE <= _buf.size()) {
+            if (_stop != nullptr && _stop->load(std::memory_order_relaxed)) {
+                _is_stopped = true;
+                break;
+            }
+            uint32_t _caplen = read_pcap_u32(_buf.data() + _pos + 8);
+            if (_caplen > _caplen_limit) {
+                LOG(ERROR) << "Corrupted packet record at byte " << _byte_num - _buf.size() + _pos;
+                _result.truncated = true;
+                break;
+            }
+            if (_caplen > _buf.size() - _pos - LEN_PCAP_RECORD_HEADER_BYTE)
+                break;
+            process_pcap_record(_buf.data() + _pos, _caplen, _result, _callback);
+            _pos += LEN_PCAP_RECORD_HEADER_BYTE + _caplen;
+        }
+        if (_result.truncated || _is_stopped)
+            break;
+        _buf.erase(_buf.begin(), _buf.begin() + _pos);
+    }
+
+    // * stops the producer if parsing ended early
+    _chunk_queue.close();
+    _producer.join();
+
+    if (!_is_pcap || !_is_header_read)
+        return false;
+    if (_is_stopped) {
+        LOG(INFO) << "Stopped reading " << filename << " after " << _byte_num / (1024 * 1024) << " MB";
+        return true;
+    }
+    if (!_buf.empty() && !_result.truncated) {
+        LOG(WARNING) << "Truncated packet record at the end of " << filename;
+        _result.truncated = true;
+    }
+    if (!_is_decompressed)
+        _result.truncated = true;
+    if (_compression == INPUT_UNCOMPRESSED)
+        LOG(INFO) << "Read " << _byte_num / (1024 * 1024) << " MB from " << filename << " with " << prefetch_read_num << " reads in flight (" << SJSV_prefetchreader::backend_name() << ")";
+    else
+        LOG(INFO) << "Decompressed " << _byte_num / (1024 * 1024) << " MB from " << filename;
+    return true;
+}
+
+size_t SJSV_pcapreader::read_file_prefix(uint8_t* _buf, size_t _len) const {
+    switch (detect_input_compression()) {
+        case INPUT_UNCOMPRESSED: {
+            std::ifstream _file(filename, std::ios::binary);
+            _file.read(reinterpret_cast<char*>(_buf), _len);
+            return _file.gcount();
+        }
+#ifdef SJSV_WITH_ZLIB
+        case INPUT_GZIP: {
+            gzFile _file = gzopen(filename.c_str(), "rb");
+            if (_file == NULL)
+                return 0;
+            int _read_len = gzread(_file, _buf, _len);
+            gzclose(_file);
+            return _read_len > 0 ? _read_len : 0;
+        }
+#endif
+#ifdef SJSV_WITH_ZSTD
+        case INPUT_ZSTD: {
+            std::ifstream _file(filename, std::ios::binary);
+            std::vector<uint8_t> _in_buf(ZSTD_DStreamInSize());
+            _file.read(reinterpret_cast<char*>(_in_buf.data()), _in_buf.size());
+            ZSTD_DStream* _dstream = ZSTD_createDStream();
+            ZSTD_initDStream(_dstream);
+            ZSTD_inBuffer  _in  = {_in_buf.data(), size_t(_file.gcount()), 0};
+            ZSTD_outBuffer _out = {_buf, _len, 0};
+            while (_in.pos < _in.size && _out.pos < _out.size) {
+                if (ZSTD_isError(ZSTD_decompressStream(_dstream, &_out, &_in)))
+                    break;
+            }
+            ZSTD_freeDStream(_dstream);
+            return _out.pos;
+        }
+#endif
+        default:
+            return 0;
+    }
+}
+
+uint64_t SJSV_pcapreader::peek_first_capture_time_ns() {
+    uint8_t _head[LEN_PCAP_GLOBAL_HEADER_BYTE + LEN_PCAP_RECORD_HEADER_BYTE];
+    if (read_file_prefix(_head, sizeof(_head)) != sizeof(_head) || !parse_pcap_global_header(_head))
+        return UINT64_MAX;
+    return record_time_ns(_head + LEN_PCAP_GLOBAL_HEADER_BYTE);
+}
+
+void SJSV_pcapreader::set_run_files(const std::vector<std::string> &_filename_vec) {
+    if (_filename_vec.empty()) {
+        LOG(ERROR) << "Run file list is empty";
+        return;
+    }
+    set_filename(_filename_vec.front());
+    run_file_vec = _filename_vec;
+    is_run_file_vec_ordered = false;
+}
+
+bool SJSV_pcapreader::expand_run_input() {
+    if (!run_file_vec.empty())
+        return true;
+
+    std::error_code _error;
+    if (!std::filesystem::is_directory(filename, _error))
+        return false;
+
+    for (auto &_entry : std::filesystem::directory_iterator(filename, _error)) {
+        if (!_entry.is_regular_file(_error))
+            continue;
+        auto _name = _entry.path().filename().string();
+        auto _extension = _entry.path().extension().string();
+        if (_name.empty() || _name[0] == '.')
+            continue;
+        if (_extension == ".pcap" || _extension == ".pcapng" || _extension == ".gz" || _extension == ".zst")
+            run_file_vec.push_back(_entry.path().string());
+    }
+    // * name order is kept for files whose capture time cannot be peeked
+    std::sort(run_file_vec.begin(), run_file_vec.end());
+    is_run_file_vec_ordered = false;
+
+    if (run_file_vec.empty()) {
+        LOG(ERROR) << "Cannot find any capture file in " << filename;
+        return false;
+    }
+    LOG(INFO) << "Found " << run_file_vec.size() << " capture files in " << filename;
+    return true;
+}
+
+std::vector<std::string> SJSV_pcapreader::get_run_files() {
+    if (!expand_run_input())
+        return std::vector<std::string>();
+    if (is_run_file_vec_ordered)
+        return run_file_vec;
+
+    std::vector<std::pair<uint64_t, std::string>> _file_times;
+    for (auto &_file : run_file_vec) {
+        SJSV_pcapreader _reader(_file);
+        auto _time_ns = _reader.peek_first_capture_time_ns();
+        if (_time_ns == UINT64_MAX)
+            LOG(WARNING) << "Cannot read the first capture time of " << _file << ", it is ordered by name";
+        _file_times.emplace_back(_time_ns, _file);
+    }
+    std::stable_sort(_file_times.begin(), _file_times.end(),
+        [](const std::pair<uint64_t, std::string> &_a, const std::pair<uint64_t, std::string> &_b) { return _a.first < _b.first; });
+    for (size_t i = 0; i < _file_times.size(); i++)
+        run_file_vec[i] = _file_times[i].second;
+    is_run_file_vec_ordered = true;
+    return run_file_vec;
+}
+
+void SJSV_pcapreader::copy_settings_to(SJSV_pcapreader &_reader) const {
+    _reader.simd_enabled           = simd_enabled;
+    _reader.frame_format_ptr       = frame_format_ptr;
+    _reader.frame_decoder          = frame_decoder;
+    _reader.packed_storage_enabled = packed_storage_enabled;
+    _reader.stream_block_frame_num = stream_block_frame_num;
+    _reader.stream_memory_cap      = stream_memory_cap;
+    _reader.link_stats_dump_interval_ns = link_stats_dump_interval_ns;
+    _reader.prefetch_read_num      = prefetch_read_num;
+}
+
+int64_t SJSV_pcapreader::decode_run_files() {
+    auto _file_vec = get_run_files();
+    auto _file_num = _file_vec.size();
+    if (_file_num == 0)
+        return -1;
+
+    is_uniframe_vec_valid = false;
+
+    // * each worker decodes whole files, spare threads go to the per-file range decoding
+    int _worker_num = std::min<int>(thread_num, _file_num);
+    int _reader_thread_num = std::max(1, thread_num / _worker_num);
+    std::vector<std::unique_ptr<SJSV_pcapreader>> _readers(_file_num);
+    std::vector<int64_t> _frame_nums(_file_num, -1);
+    std::atomic<size_t> _next_file(0);
+    std::vector<std::thread> _workers;
+    for (int w = 0; w < _worker_num; w++) {
+        _workers.emplace_back([&]() {
+            size_t i;
+            while ((i = _next_file++) < _file_num) {
+                _readers[i].reset(new SJSV_pcapreader(_file_vec[i]));
+                copy_settings_to(*_readers[i]);
+                _readers[i]->set_thread_num(_reader_thread_num);
+                _frame_nums[i] = _readers[i]->mmap_decode_pcapfile();
+            }
+        });
+    }
+    for (auto &_worker : _workers)
+        _worker.join();
+
+    // * frames are stitched in capture-time order, markers need no adjustment
+    // * because parsing keeps the last marker of a file for the next one
+    pcap_stats = pcap_statistics();
+    link_stats = link_statistics();
+    int64_t _length_vec = 0;
+    int64_t _decoded_file_num = 0;
+    for (size_t i = 0; i < _file_num; i++) {
+        if (_frame_nums[i] < 0) {
+            LOG(WARNING) << "Skipping " << _file_vec[i] << ", no frame decoded";
+            continue;
+        }
+        auto &_reader = *_readers[i];
+        if (packed_storage_enabled) {
+            packed_frames.append(_reader.packed_frames);
+        } else {
+            uni_frame_vec->insert(uni_frame_vec->end(), _reader.uni_frame_vec->begin(), _reader.uni_frame_vec->end());
+        }
+        pcap_stats.packet_num     += _reader.pcap_stats.packet_num;
+        pcap_stats.eth_packet_num += _reader.pcap_stats.eth_packet_num;
+        pcap_stats.ip_packet_num  += _reader.pcap_stats.ip_packet_num;
+        pcap_stats.udp_packet_num += _reader.pcap_stats.udp_packet_num;
+        pcap_stats.daq_packet_num += _reader.pcap_stats.daq_packet_num;
+        link_stats.merge(_reader.link_stats);
+        _length_vec += _frame_nums[i];
+        _decoded_file_num++;
+        _readers[i].reset();
+    }
+
+    if (_length_vec == 0) {
+        LOG(ERROR) << "Cannot find any DAQ packet in the run";
+        return -1;
+    }
+    log_pcap_statistics();
+    log_link_statistics();
+    LOG(INFO) << "Stitched " << _length_vec << " frames from " << _decoded_file_num << " files";
+
+    is_uniframe_vec_valid = true;
+    return _length_vec;
+}
+
+int64_t SJSV_pcapreader::for_each_run_payload(const timed_payload_callback &_callback, const std::atomic<bool>* _stop) {
+    auto _file_vec = get_run_files();
+    if (_file_vec.empty())
+        return -1;
+
+    pcap_statistics _run_stats;
+    link_statistics _run_link_stats;
+    for (auto &_file : _file_vec) {
+        if (_stop != nullptr && _stop->load(std::memory_order_relaxed))
+            break;
+        SJSV_pcapreader _reader(_file);
+        copy_settings_to(_reader);
+        if (_reader.for_each_daq_packet(_callback, _stop) < 0) {
+            LOG(WARNING) << "Skipping " << _file << ", no DAQ packet found";
+            continue;
+        }
+        _run_stats.packet_num     += _reader.pcap_stats.packet_num;
+        _run_stats.eth_packet_num += _reader.pcap_stats.eth_packet_num;
+        _run_stats.ip_packet_num  += _reader.pcap_stats.ip_packet_num;
+        _run_stats.udp_packet_num += _reader.pcap_stats.udp_packet_num;
+        _run_stats.daq_packet_num += _reader.pcap_stats.daq_packet_num;
+        _run_link_stats.merge(_reader.link_stats);
+    }
+    pcap_stats = _run_stats;
+    link_stats = _run_link_stats;
+
+    if (pcap_stats.daq_packet_num == 0) {
+        LOG(ERROR) << "Cannot find any DAQ packet in the run";
+        return -1;
+    }
+    log_pcap_statistics();
+    log_link_statistics();
+    return pcap_stats.daq_packet_num;
+}
+
+int64_t SJSV_pcapreader::stream_decode_pcapfile(input_compression _compression) {
+    is_uniframe_vec_valid = false;
+
+    std::vector<range_decode_result> _results(1);
+    std::vector<uni_frame> _scratch_vec;
+    auto &_frame_vec = packed_storage_enabled ? _scratch_vec : *uni_frame_vec;
+    auto _packed_store = packed_storage_enabled ? &packed_frames : nullptr;
+    bool _is_scanned = scan_chunked_pcapfile(_compression, _results[0], [&](const uint8_t* _payload, uint32_t _payload_len) {
+        decode_daq_payload(_payload, _payload_len, _frame_vec, _results[0], _packed_store);
+    });
+    if (!_is_scanned) {
+        // * e.g. compressed pcapng, which PcapPlusPlus reads by itself
+        LOG(WARNING) << "Falling back to PcapPlusPlus reader for " << filename;
+        return single_pass_decode_pcapfile();
+    }
+    return summarize_decode_results(_results);
+}
+
+bool SJSV_pcapreader::build_packet_index() {
+    packet_index_vec.clear();
+    pcap_statistics _stats;
+    size_t _pos = LEN_PCAP_GLOBAL_HEADER_BYTE;
+    while (_pos + LEN_PCAP_RECORD_HEADER_BYTE <= mmap_len) {
+        auto _record = mmap_data + _pos;
+        uint32_t _caplen = read_pcap_u32(_record + 8);
+        if (_caplen > mmap_len - _pos - LEN_PCAP_RECORD_HEADER_BYTE) {
+            LOG(WARNING) << "Truncated packet record at byte " << _pos;
+            break;
+        }
+        auto _packet = _record + LEN_PCAP_RECORD_HEADER_BYTE;
+
+        uint8_t _flags = 0;
+        const uint8_t* _payload = nullptr;
+        uint32_t _payload_len = 0;
+        uint16_t _src_port = 0;
+        if (locate_udp_payload(_packet, _caplen, _payload, _payload_len, _src_port)) {
+            if (_src_port == DAQ_DATA_SRC_PORT)
+                _flags |= PACKET_INDEX_FLAG_DAQ;
+        } else {
+            _flags |= PACKET_INDEX_FLAG_FALLBACK;
+            timeval _timestamp = {0, 0};
+            pcpp::RawPacket rawPacket(_packet, _caplen, _timestamp, false, pcpp::LinkLayerType(mmap_linktype));
+            pcpp::Packet parsedPacket(&rawPacket);
+            pcpp::UdpLayer* udpLayer = count_packet_layers(parsedPacket, _stats);
+            if (udpLayer != NULL && udpLayer->getSrcPort() == DAQ_DATA_SRC_PORT)
+                _flags |= PACKET_INDEX_FLAG_DAQ;
+        }
+
+        packet_index_entry _entry;
+        _entry.offset_flags = uint64_t(_pos) | (uint64_t(_flags) << 56);
+        _entry.timestamp_ns = record_time_ns(_record);
+        packet_index_vec.push_back(_entry);
+
+        _pos += LEN_PCAP_RECORD_HEADER_BYTE + _caplen;
+    }
+    return !packet_index_vec.empty();
+}
+
+bool SJSV_pcapreader::read_packet_index_file(uint64_t _file_size, int64_t _file_mtime) {
+    std::ifstream _index_file(packet_index_filename(), std::ios::binary);
+    if (!_index_file.is_open())
+        return false;
+
+    uint64_t _magic = 0, _size = 0, _entry_num = 0;
+    int64_t  _mtime = 0;
+    _index_file.read(reinterpret_cast<char*>(&_magic), sizeof(_magic));
+    _index_file.read(reinterpret_cast<char*>(&_size), sizeof(_size));
+    _index_file.read(reinterpret_cast<char*>(&_mtime), sizeof(_mtime));
+    _index_file.read(reinterpret_cast<char*>(&_entry_num), sizeof(_entry_num));
+    if (!_index_file || _magic != PACKET_INDEX_MAGIC) {
+        LOG(WARNING) << "Packet index " << packet_index_filename() << " is not valid";
+        return false;
+    }
+    if (_size != _file_size || _mtime != _file_mtime) {
+        LOG(INFO) << "Packet index " << packet_index_filename() << " is outdated";
+        return false;
+    }
+
+    packet_index_vec.resize(_entry_num);
+    _index_file.read(reinterpret_cast<char*>(packet_index_vec.data()), _entry_num * sizeof(packet_index_entry));
+    if (!_index_file) {
+        LOG(WARNING) << "Packet index " << packet_index_filename() << " is truncated";
+        packet_index_vec.clear();
+        return false;
+    }
+    return true;
+}
+
+bool SJSV_pcapreader::write_packet_index_file(uint64_t _file_size, int64_t _file_mtime) {
+    std::ofstream _index_file(packet_index_filename(), std::ios::binary | std::ios::trunc);
+    if (!_index_file.is_open()) {
+        LOG(WARNING) << "Cannot write packet index " << packet_index_filename();
+        return false;
+    }
+
+    uint64_t _magic = PACKET_INDEX_MAGIC;
+    uint64_t _entry_num = packet_index_vec.size();
+    _index_file.write(reinterpret_cast<const char*>(&_magic), sizeof(_magic));
+    _index_file.write(reinterpret_cast<const char*>(&_file_size), sizeof(_file_size));
+    _index_file.write(reinterpret_cast<const char*>(&_file_mtime), sizeof(_file_mtime));
+    _index_file.write(reinterpret_cast<const char*>(&_entry_num), sizeof(_entry_num));
+    _index_file.write(reinterpret_cast<const char*>(packet_index_vec.data()), _entry_num * sizeof(packet_index_entry));
+    return bool(_index_file);
+}
+
+bool SJSV_pcapreader::load_packet_index(bool _build_if_missing) {
+    if (is_packet_index_valid)
+        return true;
+    if (filename.empty()) {
+        LOG(ERROR) << "Filename is empty";
+        return false;
+    }
+
+    struct stat _file_stat;
+    if (stat(filename.c_str(), &_file_stat) != 0) {
+        LOG(ERROR) << "Cannot find file " << filename;
+        return false;
+    }
+    uint64_t _file_size  = _file_stat.st_size;
+    int64_t  _file_mtime = _file_stat.st_mtime;
+
+    if (read_packet_index_file(_file_size, _file_mtime)) {
+        LOG(INFO) << "Loaded packet index with " << packet_index_vec.size() << " packets";
+        is_packet_index_valid = true;
+        return true;
+    }
+    if (!_build_if_missing)
+        return false;
+
+    bool _was_mapped = mmap_data != nullptr;
+    if (!_was_mapped && !map_pcapfile()) {
+        LOG(ERROR) << "Packet index is only supported for classic pcap files";
+        return false;
+    }
+    bool _is_built = build_packet_index();
+    if (!_was_mapped)
+        unmap_pcapfile();
+    if (!_is_built) {
+        LOG(ERROR) << "Cannot find any packet in " << filename;
+        return false;
+    }
+
+    if (write_packet_index_file(_file_size, _file_mtime))
+        LOG(INFO) << "Packet index written to " << packet_index_filename();
+    LOG(INFO) << "Built packet index with " << packet_index_vec.size() << " packets";
+    is_packet_index_valid = true;
+    return true;
+}
+
+int64_t SJSV_pcapreader::find_packet_by_time(uint64_t _time_ns) const {
+    if (!is_packet_index_valid) {
+        LOG(ERROR) << "Packet index is not valid";
+        return -1;
+    }
+    auto _it = std::lower_bound(packet_index_vec.begin(), packet_index_vec.end(), _time_ns,
+        [](const packet_index_entry &_entry, uint64_t _time) { return _entry.timestamp_ns < _time; });
+    if (_it == packet_index_vec.end())
+        return -1;
+    return std::distance(packet_index_vec.begin(), _it);
+}
+
+int64_t SJSV_pcapreader::decode_indexed_packets(int64_t _first_packet, int64_t _packet_num) {
+    if (!is_packet_index_valid) {
+        LOG(ERROR) << "Packet index is not valid";
+        return -1;
+    }
+    int64_t _indexed_num = packet_index_vec.size();
+    if (_first_packet < 0 || _first_packet >= _indexed_num || _packet_num <= 0) {
+        LOG(ERROR) << "Packet range out of index";
+        return -1;
+    }
+    // * the mapping is kept for further random access until the file changes
+    if (mmap_data == nullptr && !map_pcapfile())
+        return -1;
+
+    auto _last_packet = std::min(_first_packet + _packet_num, _indexed_num);
+    size_t _begin = packet_index_vec[_first_packet].offset();
+    size_t _end   = _last_packet < _indexed_num ? packet_index_vec[_last_packet].offset() : mmap_len;
+
+    range_decode_result _result;
+    if (packed_storage_enabled) {
+        std::vector<uni_frame> _scratch_vec;
+        decode_pcap_range(_begin, _end, _scratch_vec, _result, &packed_frames);
+    } else {
+        decode_pcap_range(_begin, _end, *uni_frame_vec, _result);
+    }
+    is_uniframe_vec_valid = !uni_frame_vec->empty() || !packed_frames.empty();
+    return _result.frame_num;
+}
+
+bool SJSV_pcapreader::save_to_rootfile(const std::string &_rootfilename) {
+    if (!is_uniframe_vec_valid) {
+        LOG(ERROR) << "Uniframe vector is not valid";
+        return false;
+    }
+    if (_rootfilename.empty()) {
+        LOG(ERROR) << "Root filename is empty";
+        return false;
+    }
+
+    int64_t _entry_num = packed_storage_enabled ? packed_frames.size() : uni_frame_vec->size();
+    return write_rootfile(_rootfilename, _entry_num, [this](const frame_sink &_fill_frame) {
+        if (packed_storage_enabled) {
+            for (auto _frame : packed_frames)
+                _fill_frame(_frame);
+        } else {
+            for (auto &_frame : *uni_frame_vec)
+                _fill_frame(_frame);
+        }
+        return true;
+    });
+}
+
+bool SJSV_pcapreader::stream_to_rootfile(const std::string &_rootfilename) {
+    if (_rootfilename.empty()) {
+        LOG(ERROR) << "Root filename is empty";
+        return false;
+    }
+
+    // * the entry number is unknown in advance, clusters get the full size
+    return write_rootfile(_rootfilename, ROOT_CLUSTER_ENTRY_NUM, [this](const frame_sink &_fill_frame) {
+        auto _frame_num = stream_frame_blocks([&](const std::vector<uni_frame> &_block) {
+            for (auto &_frame : _block)
+                _fill_frame(_frame);
+            return true;
+        });
+        return _frame_num >= 0;
+    });
+}
+
+bool SJSV_pcapreader::save_to_archive(const std::string &_archivename) {
+    if (!is_uniframe_vec_valid) {
+        LOG(ERROR) << "Uniframe vector is not valid";
+        return false;
+    }
+    if (_archivename.empty()) {
+        LOG(ERROR) << "Archive filename is empty";
+        return false;
+    }
+
+    SJSV_hitarchive _archive;
+    if (!_archive.create(_archivename))
+        return false;
+    if (packed_storage_enabled) {
+        _archive.append(packed_frames);
+    } else {
+        for (auto &_frame : *uni_frame_vec)
+            _archive.append(_frame);
+    }
+    return _archive.finish();
+}
+
+bool SJSV_pcapreader::stream_to_archive(const std::string &_archivename) {
+    if (_archivename.empty()) {
+        LOG(ERROR) << "Archive filename is empty";
+        return false;
+    }
+
+    SJSV_hitarchive _archive;
+    if (!_archive.create(_archivename))
+        return false;
+    auto _frame_num = stream_frame_blocks([&](const std::vector<uni_frame> &_block) {
+        for (auto &_frame : _block)
+            _archive.append(_frame);
+        return true;
+    });
+    bool _is_written = _archive.finish();
+    return _frame_num >= 0 && _is_written;
+}
+
+bool SJSV_pcapreader::write_rootfile(const std::string &_rootfilename, int64_t _entry_num_hint, const std::function<bool(const frame_sink&)> &_frame_source) {
+    auto _time_start = std::chrono::steady_clock::now();
+
+    // * baskets of the branches are compressed in parallel when a cluster is flushed
+    bool _is_imt_owner = false;
+    if (root_thread_num != 1 && !ROOT::IsImplicitMTEnabled()) {
+        ROOT::EnableImplicitMT(std::max(root_thread_num, 0));
+        _is_imt_owner = true;
+    }
+
+    TFile* _rootfile = new TFile(_rootfilename.c_str(), "RECREATE");
+    if (_rootfile->IsZombie()) {
+        LOG(ERROR) << "Cannot open root file " << _rootfilename;
+        if (_is_imt_owner)
+            ROOT::DisableImplicitMT();
+        return false;
+    }
+    if (root_compression >= 0)
+        _rootfile->SetCompressionSettings(root_compression);
+
+    TTree* _tree = new TTree("tree", "tree");
+
+    // * one basket per branch and cluster, sized from the entry number of the capture
+    int64_t _cluster_entry_num = std::max<int64_t>(1, std::min<int64_t>(_entry_num_hint, ROOT_CLUSTER_ENTRY_NUM));
+    auto _basket_size = [_cluster_entry_num](size_t _entry_size) {
+        return int(_cluster_entry_num * _entry_size + ROOT_MIN_BASKET_SIZE_BYTE);
+    };
+
+    uint8_t  _offset;
+    uint8_t  _vmm_id;
+    uint16_t _adc;
+    uint16_t _bcid;
+    bool     _daqdata38;
+    uint8_t  _channel;
+    uint8_t  _tdc;
+    uint64_t _timestamp;
+    bool    _flag_daq;
+    uint8_t  _fec_id;
+
+    _tree->Branch("offset",    &_offset,    "offset/b",    _basket_size(sizeof(_offset)));
+    _tree->Branch("vmm_id",    &_vmm_id,    "vmm_id/b",    _basket_size(sizeof(_vmm_id)));
+    _tree->Branch("adc",       &_adc,       "adc/s",       _basket_size(sizeof(_adc)));
+    _tree->Branch("bcid",      &_bcid,      "bcid/s",      _basket_size(sizeof(_bcid)));
+    _tree->Branch("daqdata38", &_daqdata38, "daqdata38/O", _basket_size(sizeof(_daqdata38)));
+    _tree->Branch("channel",   &_channel,   "channel/b",   _basket_size(sizeof(_channel)));
+    _tree->Branch("tdc",       &_tdc,       "tdc/b",       _basket_size(sizeof(_tdc)));
+    _tree->Branch("timestamp", &_timestamp, "timestamp/l", _basket_size(sizeof(_timestamp)));
+    _tree->Branch("flag_daq",  &_flag_daq,  "flag_daq/O",  _basket_size(sizeof(_flag_daq)));
+    _tree->Branch("fec_id",    &_fec_id,    "fec_id/b",    _basket_size(sizeof(_fec_id)));
+    _tree->SetAutoFlush(_cluster_entry_num);
+
+    int64_t _entry_num = 0;
+    frame_sink _fill_frame = [&](const uni_frame &_frame) {
+        _offset    = _frame.offset;
+        _vmm_id    = _frame.vmm_id;
+        _adc       = _frame.adc;
+        _bcid      = _frame.bcid;
+        _daqdata38 = _frame.daqdata38;
+        _channel   = _frame.channel;
+        _tdc       = _frame.tdc;
+        _timestamp = _frame.timestamp;
+        _flag_daq  = _frame.flag_daq;
+        _fec_id    = _frame.fec_id;
+        _tree->Fill();
+        _entry_num++;
+    };
+    bool _is_filled = _frame_source(_fill_frame);
+
+    _rootfile->Write();
+    _rootfile->Close();
+    delete _rootfile;
+
+    if (_is_imt_owner)
+        ROOT::DisableImplicitMT();
+
+    std::chrono::duration<double> _time_used = std::chrono::steady_clock::now() - _time_start;
+    LOG(INFO) << "Wrote " << _entry_num << " entries to " << _rootfilename << " in " << _time_used.count() << " s";
+
+    return _is_filled;
+}
+
+std::string SJSV_pcapreader::test_single_frame_decode(const std::vector<uint8_t> &_test_frame) {
+    auto _frame = this->decode_single_frame(_test_frame);
+
+    std::string _str = "";
+    _str += "offset:    " + std::to_string(_frame.offset) + "\n";
+    _str += "vmm_id:    " + std::to_string(_frame.vmm_id) + "\n";
+    _str += "adc:       " + std::to_string(_frame.adc) + "\n";
+    _str += "bcid:      " + std::to_string(_frame.bcid) + "\n";
+    _str += "daqdata38: " + std::to_string(_frame.daqdata38) + "\n";
+    _str += "channel:   " + std::to_string(_frame.channel) + "\n";
+    _str += "tdc:       " + std::to_string(_frame.tdc) + "\n";
+    _str += "timestamp: " + std::to_string(_frame.timestamp) + "\n";
+    _str += "flag_daq:  " + std::to_string(_frame.flag_daq) + "\n";
+
+    return _str;
+}
+
+SJSV_pcapreader::uni_frame SJSV_pcapreader::decode_single_frame(uint8_t _byte0, uint8_t _byte1, uint8_t _byte2, uint8_t _byte3, uint8_t _byte4, uint8_t _byte5) {
+    const uint8_t _bytes[LEN_RAW_FRAME_BYTE] = {_byte0, _byte1, _byte2, _byte3, _byte4, _byte5};
+    uint64_t _word = load_frame_word(_bytes);
+    uni_frame _frame;
+    frame_decoder(&_word, (_word >> 15) & 0x1, 1, &_frame, 0);
     return _frame;
 }
\ No newline at end of file
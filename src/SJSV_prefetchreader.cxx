@@ -0,0 +1,247 @@
+#include "SJSV_prefetchreader.h"
+
+#include <cerrno>
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#ifdef SJSV_WITH_LIBURING
+#include <liburing.h>
+#endif
+
+// * Read _len bytes at _offset, retried on interrupts and short reads
+static bool pread_full(int _fd, uint8_t* _buf, size_t _len, uint64_t _offset) {
+    size_t _done = 0;
+    while (_done < _len) {
+        auto _read_len = pread(_fd, _buf + _done, _len - _done, off_t(_offset + _done));
+        if (_read_len < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        if (_read_len == 0) {
+            errno = EIO;    // file shorter than at open
+            return false;
+        }
+        _done += _read_len;
+    }
+    return true;
+}
+
+SJSV_prefetchreader::SJSV_prefetchreader(const std::string &_filename, int _read_num, size_t _chunk_byte):
+    filename(_filename),
+    read_num(std::max(_read_num, 1)),
+    chunk_byte(std::max<size_t>(_chunk_byte, 4096)),
+    file_fd(-1),
+    file_size(0),
+    byte_num(0) {}
+
+SJSV_prefetchreader::~SJSV_prefetchreader() {
+    close_file();
+}
+
+std::string SJSV_prefetchreader::backend_name() {
+#ifdef SJSV_WITH_LIBURING
+    return "io_uring";
+#else
+    return "pread threads";
+#endif
+}
+
+bool SJSV_prefetchreader::open_file() {
+    close_file();
+    file_fd = open(filename.c_str(), O_RDONLY);
+    if (file_fd < 0) {
+        LOG(ERROR) << "Cannot open file " << filename << ": " << strerror(errno);
+        return false;
+    }
+    struct stat _file_stat;
+    if (fstat(file_fd, &_file_stat) != 0) {
+        LOG(ERROR) << "Cannot stat file " << filename << ": " << strerror(errno);
+        close_file();
+        return false;
+    }
+    file_size = _file_stat.st_size;
+#ifdef __linux__
+    posix_fadvise(file_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    return true;
+}
+
+void SJSV_prefetchreader::close_file() {
+    if (file_fd >= 0) {
+        close(file_fd);
+        file_fd = -1;
+    }
+}
+
+std::vector<uint8_t> SJSV_prefetchreader::take_buffer(chunk_queue &_free_queue, size_t _len) {
+    std::vector<uint8_t> _buffer;
+    _free_queue.try_pop(_buffer);
+    _buffer.resize(_len);
+    return _buffer;
+}
+
+bool SJSV_prefetchreader::read_file(chunk_queue &_chunk_queue, chunk_queue &_free_queue) {
+    byte_num = 0;
+    if (!open_file())
+        return false;
+#ifdef SJSV_WITH_LIBURING
+    bool _is_read = read_file_uring(_chunk_queue, _free_queue);
+#else
+    bool _is_read = read_file_threads(_chunk_queue, _free_queue);
+#endif
+    close_file();
+    return _is_read;
+}
+
+bool SJSV_prefetchreader::read_file_threads(chunk_queue &_chunk_queue, chunk_queue &_free_queue) {
+    uint64_t _chunk_num = get_chunk_num();
+
+    // * slot i reads the chunks i, i + read_num, ... and holds at most one finished chunk,
+    // * so the chunks are delivered in order by visiting the slots in turn
+    std::vector<std::unique_ptr<chunk_queue>> _slot_queues;
+    for (int i = 0; i < read_num; i++)
+        _slot_queues.emplace_back(new chunk_queue(1));
+
+    std::atomic<bool> _is_failed(false);
+    std::vector<std::thread> _readers;
+    for (int _slot = 0; _slot < read_num; _slot++) {
+        _readers.emplace_back([this, _slot, _chunk_num, &_slot_queues, &_free_queue, &_is_failed]() {
+            for (uint64_t _chunk = _slot; _chunk < _chunk_num && !_is_failed.load(std::memory_order_relaxed); _chunk += read_num) {
+                auto _buffer = take_buffer(_free_queue, get_chunk_len(_chunk));
+                if (!pread_full(file_fd, _buffer.data(), _buffer.size(), _chunk * chunk_byte)) {
+                    LOG(ERROR) << "Cannot read " << filename << " at byte " << _chunk * chunk_byte << ": " << strerror(errno);
+                    _is_failed = true;
+                    break;
+                }
+                if (!_slot_queues[_slot]->push(std::move(_buffer)))
+                    break;
+            }
+            _slot_queues[_slot]->close();
+        });
+    }
+
+    for (uint64_t _chunk = 0; _chunk < _chunk_num; _chunk++) {
+        std::vector<uint8_t> _buffer;
+        if (!_slot_queues[_chunk % read_num]->pop(_buffer))
+            break;
+        byte_num += _buffer.size();
+        if (!_chunk_queue.push(std::move(_buffer)))
+            break;
+    }
+
+    // * stops the readers if the consumer ended early
+    for (auto &_slot_queue : _slot_queues)
+        _slot_queue->close();
+    for (auto &_reader : _readers)
+        _reader.join();
+    return !_is_failed;
+}
+
+#ifdef SJSV_WITH_LIBURING
+bool SJSV_prefetchreader::read_file_uring(chunk_queue &_chunk_queue, chunk_queue &_free_queue) {
+    io_uring _ring;
+    int _init_result = io_uring_queue_init(read_num, &_ring, 0);
+    if (_init_result < 0) {
+        LOG(WARNING) << "Cannot set up io_uring (" << strerror(-_init_result) << "), using pread threads";
+        return read_file_threads(_chunk_queue, _free_queue);
+    }
+
+    struct read_slot {
+        std::vector<uint8_t> buffer;
+        uint64_t chunk    = 0;
+        size_t   done     = 0;      // bytes read so far, a short read is continued
+        bool     is_ready = false;
+    };
+    std::vector<read_slot> _slots(read_num);
+    uint64_t _chunk_num = get_chunk_num();
+    uint64_t _next_chunk = 0;
+    int _in_flight = 0;
+
+    auto _submit_read = [&](int _slot_index) {
+        auto &_slot = _slots[_slot_index];
+        auto _sqe = io_uring_get_sqe(&_ring);
+        io_uring_prep_read(_sqe, file_fd, _slot.buffer.data() + _slot.done, _slot.buffer.size() - _slot.done, _slot.chunk * chunk_byte + _slot.done);
+        io_uring_sqe_set_data(_sqe, reinterpret_cast<void*>(uintptr_t(_slot_index)));
+        _in_flight++;
+    };
+    // * chunk k always uses slot k % read_num, a slot is refilled as soon as its chunk is handed over
+    auto _start_chunk = [&](int _slot_index) {
+        auto &_slot = _slots[_slot_index];
+        _slot.buffer   = take_buffer(_free_queue, get_chunk_len(_next_chunk));
+        _slot.chunk    = _next_chunk++;
+        _slot.done     = 0;
+        _slot.is_ready = false;
+        _submit_read(_slot_index);
+    };
+
+    for (int i = 0; i < read_num && _next_chunk < _chunk_num; i++)
+        _start_chunk(i);
+    io_uring_submit(&_ring);
+
+    bool _is_failed = false;
+    for (uint64_t _chunk = 0; _chunk < _chunk_num && !_is_failed; _chunk++) {
+        int _head_index = int(_chunk % read_num);
+        while (!_slots[_head_index].is_ready) {
+            io_uring_cqe* _cqe = nullptr;
+            int _wait_result = io_uring_wait_cqe(&_ring, &_cqe);
+            if (_wait_result == -EINTR)
+                continue;
+            if (_wait_result < 0) {
+                LOG(ERROR) << "Cannot wait for io_uring completion: " << strerror(-_wait_result);
+                _is_failed = true;
+                break;
+            }
+            int _slot_index = int(uintptr_t(io_uring_cqe_get_data(_cqe)));
+            int _read_result = _cqe->res;
+            io_uring_cqe_seen(&_ring, _cqe);
+            _in_flight--;
+
+            auto &_slot = _slots[_slot_index];
+            if (_read_result == -EINTR || _read_result == -EAGAIN) {
+                _submit_read(_slot_index);
+                io_uring_submit(&_ring);
+                continue;
+            }
+            if (_read_result <= 0) {
+                LOG(ERROR) << "Cannot read " << filename << " at byte " << _slot.chunk * chunk_byte + _slot.done << ": "
+                           << (_read_result < 0 ? strerror(-_read_result) : "unexpected end of file");
+                _is_failed = true;
+                break;
+            }
+            _slot.done += _read_result;
+            if (_slot.done < _slot.buffer.size()) {
+                _submit_read(_slot_index);
+                io_uring_submit(&_ring);
+                continue;
+            }
+            _slot.is_ready = true;
+        }
+        if (_is_failed)
+            break;
+
+        byte_num += _slots[_head_index].buffer.size();
+        if (!_chunk_queue.push(std::move(_slots[_head_index].buffer)))
+            break;
+        if (_next_chunk < _chunk_num) {
+            _start_chunk(_head_index);
+            io_uring_submit(&_ring);
+        }
+    }
+
+    // * reads still in flight write into the slot buffers, wait for them before they go away
+    while (_in_flight > 0) {
+        io_uring_cqe* _cqe = nullptr;
+        int _wait_result = io_uring_wait_cqe(&_ring, &_cqe);
+        if (_wait_result == -EINTR)
+            continue;
+        if (_wait_result < 0)
+            break;
+        io_uring_cqe_seen(&_ring, _cqe);
+        _in_flight--;
+    }
+    io_uring_queue_exit(&_ring);
+    return !_is_failed;
+}
+#endif
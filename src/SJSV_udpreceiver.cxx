@@ -0,0 +1,199 @@
+#include "SJSV_udpreceiver.h"
+
+#include <cerrno>
+#include <chrono>
+
+SJSV_udpreceiver::SJSV_udpreceiver(uint16_t _port, const std::string &_bind_address):
+    port(_port),
+    bind_address(_bind_address),
+    socket_fd(-1),
+    batch_size(UDP_RECV_BATCH_SIZE),
+    max_datagram_byte(UDP_MAX_DATAGRAM_BYTE),
+    socket_buffer_byte(UDP_SOCKET_BUFFER_BYTE) {
+#ifdef __linux__
+    last_drop_counter = 0;
+#endif
+}
+
+SJSV_udpreceiver::~SJSV_udpreceiver() {
+    close_socket();
+}
+
+bool SJSV_udpreceiver::open_socket() {
+    if (is_open()) {
+        LOG(WARNING) << "Socket is already open on port " << port;
+        return true;
+    }
+
+    socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (socket_fd < 0) {
+        LOG(ERROR) << "Cannot create UDP socket: " << strerror(errno);
+        return false;
+    }
+
+    int _enable = 1;
+    setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &_enable, sizeof(_enable));
+
+    // * a large kernel buffer keeps bursts from being dropped while the decoder is busy
+    if (socket_buffer_byte > 0) {
+        int _requested = socket_buffer_byte;
+#ifdef SO_RCVBUFFORCE
+        if (setsockopt(socket_fd, SOL_SOCKET, SO_RCVBUFFORCE, &_requested, sizeof(_requested)) != 0)
+#endif
+        setsockopt(socket_fd, SOL_SOCKET, SO_RCVBUF, &_requested, sizeof(_requested));
+        int _granted = 0;
+        socklen_t _granted_len = sizeof(_granted);
+        getsockopt(socket_fd, SOL_SOCKET, SO_RCVBUF, &_granted, &_granted_len);
+        if (_granted < _requested)
+            LOG(WARNING) << "Socket receive buffer is " << _granted << " bytes, requested " << _requested
+                         << " (raise net.core.rmem_max to avoid drops)";
+    }
+
+#ifdef SO_RXQ_OVFL
+    // * kernel reports the number of datagrams dropped on this socket with every message
+    setsockopt(socket_fd, SOL_SOCKET, SO_RXQ_OVFL, &_enable, sizeof(_enable));
+#endif
+
+    sockaddr_in _address;
+    memset(&_address, 0, sizeof(_address));
+    _address.sin_family = AF_INET;
+    _address.sin_port   = htons(port);
+    if (inet_pton(AF_INET, bind_address.c_str(), &_address.sin_addr) != 1) {
+        LOG(ERROR) << "Invalid bind address " << bind_address;
+        close_socket();
+        return false;
+    }
+    if (bind(socket_fd, reinterpret_cast<sockaddr*>(&_address), sizeof(_address)) != 0) {
+        LOG(ERROR) << "Cannot bind to " << bind_address << ":" << port << ": " << strerror(errno);
+        close_socket();
+        return false;
+    }
+
+    allocate_packet_pool();
+    LOG(INFO) << "Listening on " << bind_address << ":" << port << " with batches of " << batch_size << " datagrams";
+    return true;
+}
+
+void SJSV_udpreceiver::close_socket() {
+    if (socket_fd >= 0) {
+        close(socket_fd);
+        socket_fd = -1;
+    }
+}
+
+void SJSV_udpreceiver::allocate_packet_pool() {
+    pool_buffer.assign(size_t(batch_size) * max_datagram_byte, 0);
+    pool_iovec_vec.resize(batch_size);
+    for (uint32_t i = 0; i < batch_size; i++) {
+        pool_iovec_vec[i].iov_base = slot_at(i);
+        pool_iovec_vec[i].iov_len  = max_datagram_byte;
+    }
+#ifdef __linux__
+    const size_t _control_len = CMSG_SPACE(sizeof(uint32_t));
+    pool_control_buffer.assign(size_t(batch_size) * _control_len, 0);
+    pool_msg_vec.resize(batch_size);
+    for (uint32_t i = 0; i < batch_size; i++) {
+        memset(&pool_msg_vec[i], 0, sizeof(mmsghdr));
+        pool_msg_vec[i].msg_hdr.msg_iov        = &pool_iovec_vec[i];
+        pool_msg_vec[i].msg_hdr.msg_iovlen     = 1;
+        pool_msg_vec[i].msg_hdr.msg_control    = pool_control_buffer.data() + i * _control_len;
+        pool_msg_vec[i].msg_hdr.msg_controllen = _control_len;
+    }
+#endif
+}
+
+int SJSV_udpreceiver::receive_batch(const SJSV_pcapreader::payload_callback &_callback, int _timeout_ms) {
+    if (!is_open()) {
+        LOG(ERROR) << "Socket is not open";
+        return -1;
+    }
+
+    pollfd _poll_fd = {socket_fd, POLLIN, 0};
+    auto _poll_result = poll(&_poll_fd, 1, _timeout_ms);
+    if (_poll_result < 0) {
+        if (errno == EINTR)
+            return 0;
+        LOG(ERROR) << "Cannot poll the socket: " << strerror(errno);
+        return -1;
+    }
+    if (_poll_result == 0)
+        return 0;
+
+#ifdef __linux__
+    // * one system call drains up to batch_size queued datagrams
+    const size_t _control_len = CMSG_SPACE(sizeof(uint32_t));
+    for (uint32_t i = 0; i < batch_size; i++)
+        pool_msg_vec[i].msg_hdr.msg_controllen = _control_len;
+    int _msg_num = recvmmsg(socket_fd, pool_msg_vec.data(), batch_size, MSG_DONTWAIT, nullptr);
+    if (_msg_num < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return 0;
+        LOG(ERROR) << "Cannot receive from the socket: " << strerror(errno);
+        return -1;
+    }
+    for (int i = 0; i < _msg_num; i++) {
+        auto &_msg_hdr = pool_msg_vec[i].msg_hdr;
+        deliver_datagram(_callback, slot_at(i), pool_msg_vec[i].msg_len, _msg_hdr.msg_flags & MSG_TRUNC);
+#ifdef SO_RXQ_OVFL
+        for (auto _cmsg = CMSG_FIRSTHDR(&_msg_hdr); _cmsg != nullptr; _cmsg = CMSG_NXTHDR(&_msg_hdr, _cmsg)) {
+            if (_cmsg->cmsg_level != SOL_SOCKET || _cmsg->cmsg_type != SO_RXQ_OVFL)
+                continue;
+            uint32_t _drop_counter;
+            memcpy(&_drop_counter, CMSG_DATA(_cmsg), sizeof(_drop_counter));
+            // * the counter is cumulative and only attached once it is non-zero
+            recv_stats.kernel_drop_num += uint32_t(_drop_counter - last_drop_counter);
+            last_drop_counter = _drop_counter;
+        }
+#endif
+    }
+#else
+    // * without recvmmsg the queued datagrams are drained one call each
+    int _msg_num = 0;
+    while (_msg_num < int(batch_size)) {
+        auto _len = recvfrom(socket_fd, slot_at(_msg_num), max_datagram_byte, MSG_DONTWAIT, nullptr, nullptr);
+        if (_len < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                break;
+            LOG(ERROR) << "Cannot receive from the socket: " << strerror(errno);
+            return -1;
+        }
+        // * recvfrom cannot report truncation, a full slot is treated as truncated
+        deliver_datagram(_callback, slot_at(_msg_num), _len, size_t(_len) >= max_datagram_byte);
+        _msg_num++;
+    }
+#endif
+    if (_msg_num > 0)
+        recv_stats.batch_num++;
+    return _msg_num;
+}
+
+int64_t SJSV_udpreceiver::run(const SJSV_pcapreader::payload_callback &_callback, const std::atomic<bool> &_stop, int64_t _duration_ms) {
+    if (!is_open() && !open_socket())
+        return -1;
+
+    auto _start_time = std::chrono::steady_clock::now();
+    int64_t _datagram_num = 0;
+    while (!_stop.load(std::memory_order_relaxed)) {
+        auto _timeout_ms = UDP_POLL_TIMEOUT_MS;
+        if (_duration_ms >= 0) {
+            auto _elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - _start_time).count();
+            if (_elapsed_ms >= _duration_ms)
+                break;
+            _timeout_ms = int(std::min<int64_t>(_timeout_ms, _duration_ms - _elapsed_ms));
+        }
+        auto _msg_num = receive_batch(_callback, _timeout_ms);
+        if (_msg_num < 0)
+            return -1;
+        _datagram_num += _msg_num;
+    }
+    return _datagram_num;
+}
+
+void SJSV_udpreceiver::log_statistics() const {
+    LOG(INFO) << "Received " << recv_stats.datagram_num << " datagrams (" << recv_stats.byte_num << " bytes) in "
+              << recv_stats.batch_num << " batches";
+    if (recv_stats.truncated_num > 0)
+        LOG(WARNING) << "Skipped " << recv_stats.truncated_num << " datagrams larger than " << max_datagram_byte << " bytes";
+    if (recv_stats.kernel_drop_num > 0)
+        LOG(WARNING) << "Kernel dropped " << recv_stats.kernel_drop_num << " datagrams, the socket buffer overflowed";
+}
@@ -3,6 +3,7 @@ configfile: 'workflow/configs/config.yaml'
 rule pcap_process:
     conda:
         "general"
+    threads: 8
     log:
         "logs/pcap_process/pcap_process_{run_number}.log"
     output:
@@ -13,4 +14,4 @@ rule pcap_process:
         data = "data/Run{run_number}",
         mapping = "data/config/Mapping_tb2023Sep_VMM3.csv"
     shell:
-        "build/data_inspection -m {input.mapping} -d {input.data} -r {output.raw} -p {output.parsed} -a {output.browse} > {log}"
+        "build/data_inspection -m {input.mapping} -d {input.data} -r {output.raw} -p {output.parsed} -a {output.browse} -t {threads} -c lz4 -o > {log}"